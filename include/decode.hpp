@@ -0,0 +1,239 @@
+#ifndef DECODE_HEADER
+#define DECODE_HEADER
+
+// RV64IM decoder shared by sim-single, sim-pipeline and sim-cache.
+// Include after riscsim.hpp (InstType, OpType), from riscsim.cpp only.
+
+#include <stdint.h>
+
+// func7 class used as the last decode table index
+#define F7ClassNum		4
+#define OpUnknown		-1
+
+// Register fields present in each format
+class DecodeFormat
+{
+  public:
+	bool valid = false;
+	InstType type = Rtype;
+	bool has_rd = false, has_rs1 = false, has_rs2 = false;
+};
+
+// Decode tables generated at compile time. The 7-bit major opcode picks
+// the format, then (opcode, func3, func7 class) picks the OpType, so a
+// decode is two indexed loads instead of the nested switch it replaced.
+// For Itype the func7 class is only meaningful on shifts (0x00 / 0x10),
+// every other Itype op fills all classes.
+class DecodeTable
+{
+  public:
+	DecodeFormat format[128];
+	int8_t op[128][8][F7ClassNum];
+	int8_t f7class[128];
+
+	constexpr DecodeTable()
+	: format(), op(), f7class()
+	{
+		for (int i = 0; i < 128; ++i)
+		{
+			f7class[i] = 3;
+			for (int j = 0; j < 8; ++j)
+				for (int k = 0; k < F7ClassNum; ++k)
+					op[i][j][k] = OpUnknown;
+		}
+		f7class[0x00] = 0;
+		f7class[0x01] = 1;
+		f7class[0x20] = 2;
+
+		Format(0x33, Rtype, true, true, true);
+		Format(0x3b, Rtype, true, true, true);
+		Format(0x03, Itype, true, true, false);
+		Format(0x13, Itype, true, true, false);
+		Format(0x1b, Itype, true, true, false);
+		Format(0x67, Itype, true, true, false);
+		Format(0x73, Itype, true, true, false);
+		Format(0x23, Stype, false, true, true);
+		Format(0x63, SBtype, false, true, true);
+		Format(0x17, Utype, true, false, false);
+		Format(0x37, Utype, true, false, false);
+		Format(0x6f, UJtype, true, false, false);
+
+		// Rtype, class 0/1/2 = func7 0x00/0x01/0x20
+		Op(0x33, 0x0, 0, Op_add);	Op(0x33, 0x0, 1, Op_mul);	Op(0x33, 0x0, 2, Op_sub);
+		Op(0x33, 0x1, 0, Op_sll);	Op(0x33, 0x1, 1, Op_mulh);
+		Op(0x33, 0x2, 0, Op_slt);
+		Op(0x33, 0x3, 0, Op_sltu);
+		Op(0x33, 0x4, 0, Op_xor);	Op(0x33, 0x4, 1, Op_div);
+		Op(0x33, 0x5, 0, Op_srl);	Op(0x33, 0x5, 2, Op_sra);
+		Op(0x33, 0x6, 0, Op_or);	Op(0x33, 0x6, 1, Op_rem);
+		Op(0x33, 0x7, 0, Op_and);
+		Op(0x3b, 0x0, 0, Op_addw);	Op(0x3b, 0x0, 2, Op_subw);
+		Op(0x3b, 0x1, 0, Op_sllw);
+		Op(0x3b, 0x5, 0, Op_srlw);	Op(0x3b, 0x5, 2, Op_sraw);
+
+		// Itype
+		AnyOp(0x03, 0x0, Op_lb);
+		AnyOp(0x03, 0x1, Op_lh);
+		AnyOp(0x03, 0x2, Op_lw);
+		AnyOp(0x03, 0x3, Op_ld);
+		AnyOp(0x03, 0x4, Op_lbu);
+		AnyOp(0x03, 0x5, Op_lhu);
+		AnyOp(0x03, 0x6, Op_lwu);
+		AnyOp(0x13, 0x0, Op_addi);
+		Op(0x13, 0x1, 0, Op_slli);
+		AnyOp(0x13, 0x2, Op_slti);
+		AnyOp(0x13, 0x3, Op_sltiu);
+		AnyOp(0x13, 0x4, Op_xori);
+		Op(0x13, 0x5, 0, Op_srli);	Op(0x13, 0x5, 2, Op_srai);
+		AnyOp(0x13, 0x6, Op_ori);
+		AnyOp(0x13, 0x7, Op_andi);
+		AnyOp(0x1b, 0x0, Op_addiw);
+		Op(0x1b, 0x1, 0, Op_slliw);
+		Op(0x1b, 0x5, 0, Op_srliw);	Op(0x1b, 0x5, 2, Op_sraiw);
+		AnyOp(0x67, 0x0, Op_jalr);
+		Op(0x73, 0x0, 0, Op_ecall);
+
+		// Stype
+		AnyOp(0x23, 0x0, Op_sb);
+		AnyOp(0x23, 0x1, Op_sh);
+		AnyOp(0x23, 0x2, Op_sw);
+		AnyOp(0x23, 0x3, Op_sd);
+
+		// SBtype
+		AnyOp(0x63, 0x0, Op_beq);
+		AnyOp(0x63, 0x1, Op_bne);
+		AnyOp(0x63, 0x4, Op_blt);
+		AnyOp(0x63, 0x5, Op_bge);
+		AnyOp(0x63, 0x6, Op_bltu);
+		AnyOp(0x63, 0x7, Op_bgeu);
+
+		// Utype & UJtype ignore func3
+		for (int j = 0; j < 8; ++j)
+		{
+			AnyOp(0x17, j, Op_auipc);
+			AnyOp(0x37, j, Op_lui);
+			AnyOp(0x6f, j, Op_jal);
+		}
+	}
+
+  private:
+	constexpr void Format(int opcode, InstType type, bool rd, bool rs1, bool rs2)
+	{
+		format[opcode].valid = true;
+		format[opcode].type = type;
+		format[opcode].has_rd = rd;
+		format[opcode].has_rs1 = rs1;
+		format[opcode].has_rs2 = rs2;
+	}
+	constexpr void Op(int opcode, int func3, int f7, OpType optype)
+	{
+		op[opcode][func3][f7] = optype;
+	}
+	constexpr void AnyOp(int opcode, int func3, OpType optype)
+	{
+		for (int k = 0; k < F7ClassNum; ++k)
+			op[opcode][func3][k] = optype;
+	}
+};
+
+static constexpr DecodeTable decode_table;
+
+// Immediate extraction, one routine per InstType
+inline int64_t
+ImmR(uint32_t value)
+{
+	return 0;
+}
+
+inline int64_t
+ImmI(uint32_t value)
+{
+	return (int64_t)(int32_t)value >> 20;
+}
+
+inline int64_t
+ImmS(uint32_t value)
+{
+	return ((int64_t)(int32_t)(value & 0xfe000000) >> 20)
+			| ((value >> 7) & 0x1f);
+}
+
+inline int64_t
+ImmSB(uint32_t value)
+{
+	return ((int64_t)(int32_t)(value & 0x80000000) >> 19)
+			| ((value & 0x80) << 4)
+			| ((value >> 20) & 0x7e0)
+			| ((value >> 7) & 0x1e);
+}
+
+inline int64_t
+ImmU(uint32_t value)
+{
+	return (int64_t)(int32_t)(value & 0xfffff000);
+}
+
+inline int64_t
+ImmUJ(uint32_t value)
+{
+	return ((int64_t)(int32_t)(value & 0x80000000) >> 11)
+			| (value & 0xff000)
+			| ((value >> 9) & 0x800)
+			| ((value >> 20) & 0x7fe);
+}
+
+static int64_t (* const imm_decoder[])(uint32_t) =
+{
+	ImmR, ImmI, ImmS, ImmSB, ImmU, ImmUJ
+};
+
+static const char *type_str[] =
+{
+	"Rtype", "Itype", "Stype", "SBtype", "Utype", "UJtype"
+};
+
+// Fill the fields of an Instruction from its value, false if unknown
+template <class Inst> inline bool
+DecodeInst(Inst &inst)
+{
+	uint32_t value = inst.value;
+	uint32_t opcode = value & 0x7f;
+	inst.opcode = opcode;
+
+	const DecodeFormat &fmt = decode_table.format[opcode];
+	if (!fmt.valid)
+	{
+		vprintf("[Error] Unknown opcode 0x%02x. [Decode]\n", opcode);
+		return false;
+	}
+
+	InstType type = fmt.type;
+	uint32_t func3 = (value >> 12) & 0x7, func7;
+	inst.type  = type;
+	inst.func3 = func3;
+	inst.rd    = fmt.has_rd  ? (value >> 7) & 0x1f : 0;
+	inst.rs1   = fmt.has_rs1 ? (value >> 15) & 0x1f : 0;
+	inst.rs2   = fmt.has_rs2 ? (value >> 20) & 0x1f : 0;
+	inst.imm   = imm_decoder[type](value);
+
+	// Itype shifts keep func7 in bits 31-26 (bit 25 is shamt[5] on RV64)
+	if (type == Rtype)
+		func7 = value >> 25;
+	else
+		func7 = (value >> 26) & 0x3f;
+	inst.func7 = func7;
+
+	int f7 = decode_table.f7class[type == Rtype ? func7 : (func7 << 1)];
+	int op = decode_table.op[opcode][func3][f7];
+	if (op == OpUnknown)
+	{
+		vprintf("[Error] Unknown %s inst(opcode=0x%02x, func3=0x%02x, func7=0x%02x). [Decode]\n",
+				 type_str[type], opcode, func3, func7);
+		return false;
+	}
+	inst.optype = (OpType)op;
+
+	return true;
+}
+
+#endif
@@ -11,6 +11,13 @@ void sys_write_str(char *x);	// 2
 long long sys_read_int();			// 3
 char sys_read_chr();			// 4
 
+// simulator control
+void sys_checkpoint();			// 5, sim-cache writes a checkpoint
+
+// memory (sim-cache), Linux numbering
+void *sys_brk(void *addr);		// 214, addr 0 returns the break
+void *sys_mmap(long len);		// 222, anonymous only
+
 // exit syscall
 void sys_exit(int x);			// 93
 
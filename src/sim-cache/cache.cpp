@@ -1,73 +1,152 @@
 #include "machine.hpp"
 #include "utils.hpp"
+#include "checkpoint.hpp"
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-char *cache_method_str[40] =
+char *inclusion_str[InclusionNum] =
 {
-	"LRU",
-	"TWO_QUEUE"
+	"NON_INCLUSIVE",
+	"NON_INCLUSIVE",
+	"INCLUSIVE",
+	"EXCLUSIVE"
 };
 
 Cache::Cache(char *debug, CACHE_METHOD m)
 {
 	total = total_hit = 0;
+	pf_type = NO_PREFETCH;
 	pf_num = 1;
-	bypass = 0;
+	pf_dist = 1;
+	pf_interval = 0;
+	pf_max = 1;
+	prefetcher = NULL;
+	pf_buf = NULL;
+	memset(&pf_stats, 0, sizeof pf_stats);
+	pf_mark = pf_stats;
+	pf_busy = 0;
+	mshr_num = 1;
+	mshr = NULL;
+	memset(&mshr_stats, 0, sizeof mshr_stats);
+	incl = NON_INCLUSIVE;
+	victim_fill = false;
+	own_prefetch = false;
+	memset(&incl_stats, 0, sizeof incl_stats);
+	victim_num = 0;
+	victim_clock = 0;
+	memset(&victim_stats, 0, sizeof victim_stats);
+	dead_mode = NO_DEAD_BLOCK;
+	deadblock = NULL;
+	memset(&dead_stats, 0, sizeof dead_stats);
 	method = m;
+	policy = NULL;
+	arena = NULL;
+	tag_only = false;
+	tags = NULL;
+	meta = NULL;
+	ready = NULL;
 	strcpy(name, debug);
 }
 
 Cache::~Cache()
 {
-
+	delete policy;
+	delete prefetcher;
+	delete deadblock;
+	delete[] pf_buf;
+	delete[] tags;
+	delete[] meta;
+	delete[] ready;
+	delete[] mshr;
+	delete[] arena;
 }
 
 void
-Cache::HandleRequest(uint64_t addr, int bytes, int read,
-					uint8_t *content, int &hit, int &time,
-					bool prefetching)
+Cache::HandleRequest(const MemRequest &req,
+					uint8_t *content, int &hit, int &time)
 {
+	uint64_t addr = req.addr;
+	int bytes = req.bytes, read = req.read;
+	bool prefetching = req.type == AccessPrefetch;
 	// dprintf("%s: requested on 0x%llx, %d bytes, read: %d\n", name, addr, bytes, read);
 	int vic_id = 0;
 	int lower_hit, lower_time;
 
-	if (!prefetching) total++;
 	hit = 0;
 	time = 0;
-	// Bypass?
-	if (!BypassDecision(addr))
+	// a whole line evicted from above: writebacks, clean victims and the
+	// writebacks of prefetch fills (a prefetch itself always reads).
+	// Smaller upper lines write back as plain writes.
+	bool evicted = req.type == AccessWriteback || req.type == AccessVictim
+					|| (prefetching && !read);
+	if (Exclusive() && evicted && bytes == config_.line_size)
+	{
+		VictimFill(req, content, hit, time);
+		return;
+	}
+	if (!prefetching) total++;
+	vic_id = ReplaceDecision(addr);
+	// the victim cache is looked up after the set
+	if (vic_id == -1 && (vic_id = VictimSwap(addr)) != -1)
+	{
+		if (!prefetching)
+			victim_stats.hits++;
+		time += latency_.hit_latency;
+		stats_.access_time += latency_.hit_latency;
+	}
 	{
 		// cache miss
-		if ((vic_id = ReplaceDecision(addr)) == -1)
+		if (vic_id == -1)
 		{
 			// dprintf("%s: miss.\n", name);
+			// exclusive: the fill goes past this level
+			if (Exclusive() && read && !own_prefetch)
+			{
+				lower_->HandleRequest(req, content, lower_hit, lower_time);
+				time += latency_.bus_latency + lower_time;
+				stats_.access_time += latency_.bus_latency;
+				if (!prefetching && PrefetchDecision())
+					PrefetchAlgorithm(req, true, false);
+				return;
+			}
+			// one MSHR is always left for a demand miss
+			if (prefetching && mshr && MshrFree(req.time) < 2)
+			{
+				mshr_stats.drops++;
+				return;
+			}
 			if (!read && !config_.write_allocate) // no-write allocate
 			{
-				lower_->HandleRequest(addr, bytes, read, content,
-									lower_hit, lower_time, prefetching);
+				lower_->HandleRequest(req, content, lower_hit, lower_time);
 				time += lower_time;
 				return;
 			}
 
-			// Choose victim
-			vic_id = ReplaceAlgorithm(addr);
-			hit = 0;
-
-			// recently evicted
-			if (lines[vic_id].valid)
-				r_evict[GET_CACHE_SET(addr)] = lines[vic_id].tag;
-
-			// dirty writeback
-			if (lines[vic_id].valid && lines[vic_id].dirty)
+			// dead on arrival: bypassed, or the next to go. An inclusive
+			// level has to hold what is above, so it never bypasses.
+			bool dead = DeadDecision(req);
+			if (dead && dead_mode == DEAD_BYPASS && (incl != INCLUSIVE || uppers.empty()))
 			{
-				lower_->HandleRequest(GET_CACHE_ADDR(lines[vic_id].tag, vic_id/config_.assoc), config_.line_size, 0,
-									lines[vic_id].data, lower_hit, lower_time, prefetching);
-				time += lower_time;
+				dead_stats.bypassed++;
+				lower_->HandleRequest(req, content, lower_hit, lower_time);
+				time += latency_.bus_latency + lower_time;
+				stats_.access_time += latency_.bus_latency;
+				return;
 			}
-			lines[vic_id].valid = true;
-			lines[vic_id].dirty = false;
-			lines[vic_id].tag = GET_CACHE_TAG(addr);
+
+			// Choose victim
+			vic_id = ReplaceAlgorithm(addr, dead);
+			hit = 0;
+			Evict(vic_id, req, time);
+			tags[vic_id] = GET_CACHE_TAG(addr);
+			if (deadblock)
+				deadblock->Fill(vic_id, DeadBlockPredictor::Signature(req.pc, addr));
+			if (dead)
+				meta[vic_id] |= LineDead;
 		}
 
 		// cache hit
@@ -75,18 +154,41 @@ Cache::HandleRequest(uint64_t addr, int bytes, int read,
 		{
 			// dprintf("%s: hit.\n", name);
 			if (!prefetching) total_hit++;
+			bool pf_hit = !prefetching && (meta[vic_id] & LinePrefetched);
+			if (pf_hit)
+			{
+				meta[vic_id] &= ~LinePrefetched;
+				pf_stats.useful++;
+				if (ready[vic_id] > req.time)
+					pf_stats.late++;
+			}
+			if (!prefetching && deadblock)
+			{
+				deadblock->Hit(vic_id);
+				if (meta[vic_id] & LineDead)
+					dead_stats.reused++;
+				meta[vic_id] &= ~LineDead;
+			}
 			// return hit & time
 			hit = 1;
 			time += latency_.bus_latency + latency_.hit_latency;
 			stats_.access_time += latency_.bus_latency + latency_.hit_latency;
+			// secondary miss, merged into the fill in flight
+			if (mshr && ready[vic_id] > req.time + time)
+			{
+				if (!prefetching)
+					mshr_stats.merges++;
+				time = ready[vic_id] - req.time;
+			}
 
 			if (!read) // write
 			{
 				// copy contents
 				if (bytes <= config_.line_size)
 				{
-					memcpy(lines[vic_id].data + GET_CACHE_OFFSET(addr), content,
-							bytes);
+					if (arena)
+						memcpy(Data(vic_id) + GET_CACHE_OFFSET(addr), content,
+								bytes);
 				}
 				else
 				{
@@ -97,13 +199,12 @@ Cache::HandleRequest(uint64_t addr, int bytes, int read,
 				
 				if (config_.write_through) // write through
 				{
-					lower_->HandleRequest(addr, bytes, read, content,
-										lower_hit, lower_time, prefetching);
+					lower_->HandleRequest(req, content, lower_hit, lower_time);
 					time += lower_time;
 				}	
 				else
 				{
-					lines[vic_id].dirty = true;
+					meta[vic_id] |= LineDirty;
 				}
 			}
 
@@ -111,8 +212,9 @@ Cache::HandleRequest(uint64_t addr, int bytes, int read,
 			{
 				if (bytes <= config_.line_size)
 				{
-					memcpy(content, lines[vic_id].data + GET_CACHE_OFFSET(addr),
-							bytes);
+					if (arena)
+						memcpy(content, Data(vic_id) + GET_CACHE_OFFSET(addr),
+								bytes);
 				}
 				else
 				{
@@ -120,43 +222,76 @@ Cache::HandleRequest(uint64_t addr, int bytes, int read,
 							bytes, config_.line_size);
 					exit(0);
 				}
+
+				// exclusive: the level above holds the only copy from now on,
+				// a dirty line is written down first, off the access time
+				if (Exclusive() && !own_prefetch)
+				{
+					if (meta[vic_id] & LineDirty)
+					{
+						MemRequest wb = req;
+						wb.addr = GET_CACHE_ALIGN(addr);
+						wb.bytes = config_.line_size;
+						wb.read = 0;
+						wb.type = prefetching ? AccessPrefetch : AccessWriteback;
+						lower_->HandleRequest(wb, Data(vic_id), lower_hit, lower_time);
+					}
+					tags[vic_id] = InvalidTag;
+					meta[vic_id] = 0;
+					ready[vic_id] = 0;
+					incl_stats.moved_up++;
+				}
 			}
 
+			if (!prefetching && PrefetchDecision())
+				PrefetchAlgorithm(req, false, pf_hit);
 			return;
 		}
 	}
-	else // bypass
-	{
-		lower_->HandleRequest(addr, bytes, read, content,
-							lower_hit, lower_time, prefetching);
-		time += lower_time;
-		return;
-	}
-
-	// Prefetch?
-	if (!prefetching && PrefetchDecision())
-	{
-		PrefetchAlgorithm(GET_CACHE_ADDR(lines[vic_id].tag, vic_id/config_.assoc));
-	}
 
 	{
 
 		if (!read) // write first
 		{
-			lower_->HandleRequest(addr, bytes, 0, content, 
-								lower_hit, lower_time, prefetching);
+			lower_->HandleRequest(req, content, lower_hit, lower_time);
 			time += latency_.bus_latency + lower_time;
 			stats_.access_time += latency_.bus_latency;
 		}
 
-		// Fetch from lower layer
-		lower_->HandleRequest(GET_CACHE_ALIGN(addr), config_.line_size, 1, lines[vic_id].data,
-							lower_hit, lower_time, prefetching);
+		// Fetch from lower layer, non-blocking: in the first MSHR free
+		MemRequest fill = req;
+		fill.addr = GET_CACHE_ALIGN(addr);
+		fill.bytes = config_.line_size;
+		fill.read = 1;
+		int slot = -1;
+		if (mshr)
+		{
+			slot = MshrFirst();
+			if (mshr[slot] > fill.time)
+			{
+				if (!prefetching)
+					mshr_stats.full++;
+				fill.time = mshr[slot];
+			}
+		}
+		lower_->HandleRequest(fill, Data(vic_id), lower_hit, lower_time);
 		if (read)
 		{
-			time += latency_.bus_latency + lower_time;
+			time += (fill.time - req.time) + latency_.bus_latency + lower_time;
 			stats_.access_time += latency_.bus_latency;
 		}
+		if (slot >= 0)
+			mshr[slot] = ready[vic_id] = fill.time + latency_.bus_latency + lower_time;
+		if (prefetching && read)
+		{
+			meta[vic_id] |= LinePrefetched;
+			if (slot < 0)
+			{
+				pf_busy = (pf_busy > req.time ? pf_busy : req.time) + latency_.bus_latency + lower_time;
+				ready[vic_id] = pf_busy;
+			}
+			pf_stats.fills++;
+		}
 
 		// write allocate or read miss
 		// dprintf("%s: vic_id %d offset 0x%llx\n", name, vic_id, GET_CACHE_OFFSET(addr));
@@ -164,8 +299,9 @@ Cache::HandleRequest(uint64_t addr, int bytes, int read,
 		{
 			if (bytes <= config_.line_size)
 			{
-				memcpy(content, lines[vic_id].data + GET_CACHE_OFFSET(addr),
-						bytes);
+				if (arena)
+					memcpy(content, Data(vic_id) + GET_CACHE_OFFSET(addr),
+							bytes);
 			}
 			else
 			{
@@ -175,179 +311,617 @@ Cache::HandleRequest(uint64_t addr, int bytes, int read,
 			}
 		}
 	}
+
+	// Prefetch? Only now, a prefetch may pick the line just filled
+	if (!prefetching && PrefetchDecision())
+	{
+		PrefetchAlgorithm(req, true, false);
+	}
 }
 
-int
-Cache::BypassDecision(uint64_t addr)
+// Make room for a line: the victim goes to the victim cache if there
+// is one, out of this level otherwise
+void
+Cache::Evict(int vic_id, const MemRequest &req, int &time)
 {
-	if (!bypass) return false;
-	uint64_t tag = GET_CACHE_TAG(addr);
-	uint64_t set_id = GET_CACHE_SET(addr);
+	if (tags[vic_id] != InvalidTag)
+	{
+		if (req.type == AccessPrefetch && req.read)
+			pf_stats.evictions++;
+		if (victim_num)
+		{
+			int v = VictimSlot();
+			if (tags[v] != InvalidTag)
+				Retire(v, req, time);
+			VictimMove(v, vic_id);
+		}
+		else
+			Retire(vic_id, req, time);
+	}
+	meta[vic_id] = 0;
+}
 
-	CacheLine *d = lines + set_id*config_.assoc;
-	for (int i = 0; i < config_.assoc; ++i)
-		if (!d[i].valid || d[i].tag == tag) // cold miss
-			return false;
+// A line leaves this level: stats, back-invalidation, then it goes down
+// if dirty, or clean into an exclusive lower level
+void
+Cache::Retire(int line, const MemRequest &req, int &time)
+{
+	bool prefetching = req.type == AccessPrefetch;
+	int lower_hit, lower_time;
+
+	if (meta[line] & LinePrefetched)
+		pf_stats.useless++;
+	if (deadblock)
+		deadblock->Evict(line);
+	if (incl == INCLUSIVE)
+		BackInvalidate(line);
 
-	if (r_evict[set_id] == tag) // capacity miss
+	// dirty writeback
+	if ((meta[line] & LineDirty) || victim_fill)
 	{
-		printf("here conflict miss 0x%x\n", tag);
-		// r_evict[set_id] = tag;
-		return true;
+		MemRequest wb = req;
+		wb.addr = LineAddr(line);
+		wb.bytes = config_.line_size;
+		wb.read = 0;
+		wb.type = prefetching ? AccessPrefetch : AccessWriteback; // prefetch traffic is not counted
+		if (!(meta[line] & LineDirty))
+			wb.type = AccessVictim;
+		lower_->HandleRequest(wb, Data(line), lower_hit, lower_time);
+		time += lower_time;
+	}
+	tags[line] = InvalidTag;
+	meta[line] = 0;
+}
+
+// Inclusive: the victim leaves every level above too, their dirty data
+// is newer and goes down with it
+void
+Cache::BackInvalidate(int line)
+{
+	bool dirty = false;
+	uint64_t addr = LineAddr(line);
+	for (size_t u = 0; u < uppers.size(); ++u)
+		incl_stats.back_inval += uppers[u]->Invalidate(addr, config_.line_size, Data(line), dirty);
+	if (dirty)
+	{
+		incl_stats.back_dirty++;
+		meta[line] |= LineDirty;
 	}
-	return false;
 }
 
 int
-Cache::ReplaceDecision(uint64_t addr) 
+Cache::Invalidate(uint64_t addr, int bytes, uint8_t *data, bool &dirty)
 {
-	uint64_t set_id = GET_CACHE_SET(addr);
-	uint64_t tag = GET_CACHE_TAG(addr);
-	CacheLine *d = lines + set_id*config_.assoc;
+	int n = 0;
+	for (uint64_t a = GET_CACHE_ALIGN(addr); a < addr + bytes; a += config_.line_size)
+	{
+		uint64_t set_id = GET_CACHE_SET(a);
+		int way = FindWay(tags + set_id*config_.assoc, GET_CACHE_TAG(a));
+		int line = way == -1 ? VictimFind(a) : set_id*config_.assoc + way;
+		if (line == -1)
+			continue;
+		if (meta[line] & LineDirty)
+		{
+			dirty = true;
+			if (data && arena)
+			{
+				uint64_t lo = a > addr ? a : addr;
+				uint64_t hi = a + config_.line_size < addr + bytes ? a + config_.line_size : addr + bytes;
+				memcpy(data + (lo - addr), Data(line) + (lo - a), hi - lo);
+			}
+		}
+		tags[line] = InvalidTag;
+		meta[line] = 0;
+		ready[line] = 0;
+		n++;
+	}
+	// copies above are newer, so they are copied last
+	for (size_t u = 0; u < uppers.size(); ++u)
+		n += uppers[u]->Invalidate(addr, bytes, data, dirty);
+	return n;
+}
+
+// Exclusive: a line evicted from above, dirty or not, is installed
+// without a fill from below. Counted as a victim fill, not an access.
+void
+Cache::VictimFill(const MemRequest &req, uint8_t *content, int &hit, int &time)
+{
+	int vic_id = ReplaceDecision(req.addr);
+	if (vic_id == -1)
+		vic_id = VictimSwap(req.addr);
+	hit = vic_id != -1;
+	time = latency_.bus_latency + latency_.hit_latency;
+	stats_.access_time += latency_.bus_latency + latency_.hit_latency;
+	if (!hit)
+	{
+		vic_id = ReplaceAlgorithm(req.addr);
+		Evict(vic_id, req, time);
+		tags[vic_id] = GET_CACHE_TAG(req.addr);
+		ready[vic_id] = 0;
+		if (deadblock)
+			deadblock->Fill(vic_id, DeadBlockPredictor::Signature(req.pc, req.addr));
+	}
+	if (arena)
+		memcpy(Data(vic_id), content, config_.line_size);
+	if (req.type != AccessVictim)
+		meta[vic_id] |= LineDirty;
+	incl_stats.victim_fills++;
+}
 
-	for (int i = 0; i < config_.assoc; ++i)
-		if (d[i].valid && d[i].tag == tag)
+// Replacement state only, lines filled here hold no valid data until
+// SyncData is called
+void
+Cache::Warm(uint64_t addr, int read)
+{
+	int line = ReplaceDecision(addr);
+	if (line == -1)
+		line = VictimSwap(addr);
+	if (line != -1)
+	{
+		// exclusive: moved up, a dirty line is written down first
+		if (Exclusive())
 		{
-			if (method == TWO_QUEUE && !d[i].inlru) // push into lru queue
+			if (meta[line] & LineDirty)
 			{
-				d[i].inlru = true;
+				if (victim_fill)
+					((Cache*)lower_)->WarmVictim(GET_CACHE_ALIGN(addr));
+				else
+					lower_->Warm(GET_CACHE_ALIGN(addr), 0);
 			}
+			tags[line] = InvalidTag;
+			meta[line] = 0;
+			ready[line] = 0;
+		}
+		return;
+	}
+
+	if (Exclusive())
+		read = 1; // line fill passing through
+	else if (read || config_.write_allocate)
+	{
+		WarmInstall(addr);
+		read = 1; // line fill
+	}
+	lower_->Warm(addr, read);
+}
 
-			// update
-			d[i].last_vis = config_.assoc;
-			for (int j = 0; j < config_.assoc; ++j)
-				d[j].last_vis--;
+// A clean line evicted from above while warming
+void
+Cache::WarmVictim(uint64_t addr)
+{
+	if (ReplaceDecision(addr) == -1 && VictimFind(addr) == -1)
+		WarmInstall(addr);
+}
 
-			return i + set_id*config_.assoc;
+// Tag of addr in a free or victim way, what leaves goes to the victim
+// cache or out of this level
+int
+Cache::WarmInstall(uint64_t addr)
+{
+	int vic_id = ReplaceAlgorithm(addr);
+	if (tags[vic_id] != InvalidTag)
+	{
+		if (victim_num)
+		{
+			int v = VictimSlot();
+			if (tags[v] != InvalidTag)
+				WarmRetire(v);
+			VictimMove(v, vic_id);
 		}
+		else
+			WarmRetire(vic_id);
+	}
+	meta[vic_id] = 0;
+	tags[vic_id] = GET_CACHE_TAG(addr);
+	if (deadblock)
+		deadblock->Forget(vic_id);
+	return vic_id;
+}
 
-	return -1;
+// A line leaving while warming is invalidated above or handed to an
+// exclusive lower level
+void
+Cache::WarmRetire(int line)
+{
+	uint64_t old = LineAddr(line);
+	bool dirty = false;
+	if (incl == INCLUSIVE)
+		for (size_t u = 0; u < uppers.size(); ++u)
+			uppers[u]->Invalidate(old, config_.line_size, NULL, dirty);
+	if (victim_fill)
+		((Cache*)lower_)->WarmVictim(old);
+	tags[line] = InvalidTag;
+	meta[line] = 0;
 }
 
+// Victim cache line holding addr, -1 if none
 int
-Cache::ReplaceAlgorithm(uint64_t addr)
+Cache::VictimFind(uint64_t addr)
 {
-	// now LRU algorithm
+	if (!victim_num)
+		return -1;
+	int v = FindWay(tags + Lines(), addr / config_.line_size, victim_num);
+	return v == -1 ? -1 : Lines() + v;
+}
 
-	uint64_t set_id = GET_CACHE_SET(addr);
-	uint64_t tag = GET_CACHE_TAG(addr);
-	CacheLine *d = lines + set_id*config_.assoc;
+// Victim cache hit: the line goes back to its set, the way it takes
+// moves into the victim cache in its place. Returns the line in the set.
+int
+Cache::VictimSwap(uint64_t addr)
+{
+	int v = VictimFind(addr);
+	if (v == -1)
+		return -1;
+
+	int line = ReplaceAlgorithm(addr);
+	policy->Touch(line / config_.assoc, line % config_.assoc);
+	uint64_t old = tags[line] == InvalidTag ? InvalidTag : LineAddr(line) / config_.line_size;
+	tags[line] = GET_CACHE_TAG(addr);
+	tags[v] = old;
+	std::swap(meta[line], meta[v]);
+	std::swap(ready[line], ready[v]);
+	if (arena)
+		std::swap_ranges(Data(line), Data(line) + config_.line_size, Data(v));
+	if (deadblock)
+		deadblock->Swap(line, v);
+	if (old == InvalidTag)
+		meta[v] = ready[v] = 0;
+	victim_stamp[v - Lines()] = ++victim_clock;
+	return line;
+}
 
-	if (method == LRU)
+// Free victim cache line, or the oldest one
+int
+Cache::VictimSlot()
+{
+	int v = FindWay(tags + Lines(), InvalidTag, victim_num);
+	if (v == -1)
 	{
-		int vic_id = -1;
-		for (int i = 0; i < config_.assoc; ++i)
-			if (!d[i].valid)
-			{
-				vic_id = i;
-				break;
-			}
+		v = 0;
+		for (int i = 1; i < victim_num; ++i)
+			if (victim_stamp[i] < victim_stamp[v])
+				v = i;
+		victim_stats.evictions++;
+	}
+	return Lines() + v;
+}
 
-		if (vic_id == -1)
+// Valid line of a set into the free victim cache line v
+void
+Cache::VictimMove(int v, int line)
+{
+	tags[v] = LineAddr(line) / config_.line_size;
+	meta[v] = meta[line];
+	ready[v] = ready[line];
+	if (arena)
+		memcpy(Data(v), Data(line), config_.line_size);
+	if (deadblock)
+		deadblock->Swap(v, line);
+	victim_stamp[v - Lines()] = ++victim_clock;
+	tags[line] = InvalidTag;
+	meta[line] = 0;
+}
+
+// Addresses of the valid lines
+void
+Cache::ValidLines(std::vector<uint64_t> &addrs)
+{
+	int tot = Lines() + victim_num;
+	for (int i = 0; i < tot; ++i)
+		if (tags[i] != InvalidTag)
+			addrs.push_back(LineAddr(i));
+}
+
+// Reload every valid line from memory after warming
+void
+Cache::SyncData(Storage *mem)
+{
+	int hit, time;
+	int tot = Lines() + victim_num;
+	for (int i = 0; i < tot; ++i)
+		if (tags[i] != InvalidTag)
 		{
-			int min_vis = config_.assoc;
-			for (int i = 0; i < config_.assoc; ++i)
-				if (d[i].last_vis < min_vis)
-				{
-					vic_id = i;
-					min_vis = d[i].last_vis;
-				}
+			mem->HandleRequest(MakeRequest(LineAddr(i), config_.line_size, 1,
+								AccessLoad), Data(i), hit, time);
+			meta[i] &= ~LineDirty;
 		}
+}
 
-		if (d[vic_id].valid)
+// Write dirty lines straight to memory before running functionally
+void
+Cache::WriteBackDirty(Storage *mem)
+{
+	int hit, time;
+	int tot = Lines() + victim_num;
+	for (int i = 0; i < tot; ++i)
+		if (tags[i] != InvalidTag && (meta[i] & LineDirty))
 		{
-			// dprintf("%s: (%llx-%llx) was replaced.\n", name, d[vic_id].tag, set_id);
+			mem->HandleRequest(MakeRequest(LineAddr(i), config_.line_size, 0,
+								AccessWriteback), Data(i), hit, time);
+			meta[i] &= ~LineDirty;
 		}
-		d[vic_id].last_vis = config_.assoc;
-		for (int i = 0; i < config_.assoc; ++i)
-			d[i].last_vis--;
+}
 
-		// dprintf("%s: 0x%llx(%llx-%llx) loaded in.\n", name, addr, tag, set_id);
-		return vic_id + set_id*config_.assoc;
-	}
+// Checkpoint: geometry, counters and the valid lines only
+bool
+Cache::Save(FILE *f)
+{
+	int tot = Lines() + victim_num, valid = 0;
+	for (int i = 0; i < tot; ++i)
+		if (tags[i] != InvalidTag)
+			valid++;
+
+	int head[12] = {config_.size, config_.assoc, config_.line_size, method,
+					prefetcher ? pf_type : NO_PREFETCH, mshr ? mshr_num : 1, incl, victim_num, dead_mode,
+					total, total_hit, valid};
+	uint64_t clock[2] = {pf_busy, prefetcher ? (uint64_t)prefetcher->Degree() : 0};
+	if (!CkptWrite(f, head, sizeof head) || !policy->Save(f)
+		|| (prefetcher && !prefetcher->Save(f)) || !CkptWrite(f, clock, sizeof clock)
+		|| !CkptWrite(f, &pf_stats, sizeof pf_stats) || !CkptWrite(f, &pf_mark, sizeof pf_mark)
+		|| !CkptWrite(f, &mshr_stats, sizeof mshr_stats) || !CkptWrite(f, &incl_stats, sizeof incl_stats)
+		|| (mshr && !CkptWrite(f, mshr, mshr_num * sizeof(uint64_t))))
+		return false;
+	if (!CkptWrite(f, &victim_clock, sizeof victim_clock) || !CkptWriteVec(f, victim_stamp)
+		|| !CkptWrite(f, &victim_stats, sizeof victim_stats) || !CkptWrite(f, &dead_stats, sizeof dead_stats)
+		|| (deadblock && !deadblock->Save(f)))
+		return false;
+	for (int i = 0; i < tot; ++i)
+		if (tags[i] != InvalidTag)
+		{
+			int64_t rec[4] = {i, (int64_t)tags[i], meta[i], (int64_t)ready[i]};
+			if (!CkptWrite(f, rec, sizeof rec) || !CkptWrite(f, Data(i), config_.line_size))
+				return false;
+		}
+	return true;
+}
 
-	if (method == TWO_QUEUE)
+bool
+Cache::Load(FILE *f)
+{
+	int head[12];
+	int64_t rec[4];
+	uint64_t clock[2];
+	if (!CkptRead(f, head, sizeof head))
+		return false;
+	if (head[0] != config_.size || head[1] != config_.assoc || head[2] != config_.line_size
+		|| head[3] != method || head[4] != (prefetcher ? pf_type : NO_PREFETCH)
+		|| head[5] != (mshr ? mshr_num : 1) || head[6] != incl || head[7] != victim_num
+		|| head[8] != dead_mode)
 	{
-		int vic_id = -1;
-		for (int i = 0; i < config_.assoc; ++i)
-			if (!d[i].valid)
-			{
-				vic_id = i;
-				break;
-			}
+		vprintf("[Error] %s config differs from checkpoint. [Cache::Load]\n", name);
+		return false;
+	}
+	total = head[9];
+	total_hit = head[10];
+	if (!policy->Load(f) || (prefetcher && !prefetcher->Load(f)) || !CkptRead(f, clock, sizeof clock)
+		|| !CkptRead(f, &pf_stats, sizeof pf_stats) || !CkptRead(f, &pf_mark, sizeof pf_mark)
+		|| !CkptRead(f, &mshr_stats, sizeof mshr_stats) || !CkptRead(f, &incl_stats, sizeof incl_stats)
+		|| (mshr && !CkptRead(f, mshr, mshr_num * sizeof(uint64_t))))
+		return false;
+	if (!CkptRead(f, &victim_clock, sizeof victim_clock) || !CkptReadVec(f, victim_stamp)
+		|| !CkptRead(f, &victim_stats, sizeof victim_stats) || !CkptRead(f, &dead_stats, sizeof dead_stats)
+		|| (deadblock && !deadblock->Load(f)))
+		return false;
+	pf_busy = clock[0];
+	if (prefetcher)
+		prefetcher->SetDegree(clock[1] >= 1 && clock[1] <= (uint64_t)pf_max ? clock[1] : pf_num - 1);
+
+	int tot = Lines() + victim_num;
+	for (int i = 0; i < tot; ++i)
+	{
+		tags[i] = InvalidTag;
+		meta[i] = 0;
+		ready[i] = 0;
+	}
+	for (int k = 0; k < head[11]; ++k)
+	{
+		if (!CkptRead(f, rec, sizeof rec) || rec[0] < 0 || rec[0] >= tot)
+			return false;
+		int i = rec[0];
+		tags[i] = rec[1];
+		meta[i] = rec[2] & (LineDirty | LinePrefetched | LineDead);
+		ready[i] = rec[3];
+		if (!CkptRead(f, Data(i), config_.line_size))
+			return false;
+	}
+	return true;
+}
 
-		if (vic_id == -1)
-		{
-			int min_vis = config_.assoc;
-			for (int i = 0; i < config_.assoc; ++i)
-				if (!d[i].inlru && d[i].last_vis < min_vis) // in fifo queue
-				{
-					vic_id = i;
-					min_vis = d[i].last_vis;
-				}
+// Demand fills only, the sampled sets fill regardless so that the
+// signatures they bypass keep training
+bool
+Cache::DeadDecision(const MemRequest &req)
+{
+	if (!deadblock || req.type > AccessStore)
+		return false;
+	if (GET_CACHE_SET(req.addr) % DeadSamplePeriod == 0)
+		return false;
+	if (!deadblock->Dead(DeadBlockPredictor::Signature(req.pc, req.addr)))
+		return false;
+	dead_stats.predicted++;
+	return true;
+}
 
-			if (vic_id == -1) // find in lru queue
-			{
-				for (int i = 0; i < config_.assoc; ++i)
-					if (d[i].last_vis < min_vis) // in lru queue
-					{
-						vic_id = i;
-						min_vis = d[i].last_vis;
-					}	
-			}
-		}
+int
+Cache::ReplaceDecision(uint64_t addr) 
+{
+	uint64_t set_id = GET_CACHE_SET(addr);
+	uint64_t tag = GET_CACHE_TAG(addr);
+	int base = set_id*config_.assoc;
+	int i = FindWay(tags + base, tag);
+	if (i == -1)
+		return -1;
 
-		if (d[vic_id].valid)
-		{
-			// dprintf("%s: (%llx-%llx) was replaced.\n", name, d[vic_id].tag, set_id);
-		}
-		d[vic_id].inlru = false;
-		d[vic_id].last_vis = config_.assoc;
-		for (int i = 0; i < config_.assoc; ++i)
-			d[i].last_vis--;
+	policy->Touch(set_id, i);
+	return i + base;
+}
 
-		// dprintf("%s: 0x%llx(%llx-%llx) loaded in.\n", name, addr, tag, set_id);
-		return vic_id + set_id*config_.assoc;
+int
+Cache::ReplaceAlgorithm(uint64_t addr, bool distant)
+{
+	uint64_t set_id = GET_CACHE_SET(addr);
+	int vic_id = FindWay(tags + set_id*config_.assoc, InvalidTag);
+	if (vic_id == -1)
+		vic_id = policy->Victim(set_id);
+
+	// dprintf("%s: 0x%llx(%llx-%llx) loaded in.\n", name, addr, GET_CACHE_TAG(addr), set_id);
+	if (distant)
+		policy->InsertDistant(set_id, vic_id);
+	else
+		policy->Insert(set_id, vic_id);
+	return vic_id + set_id*config_.assoc;
+}
+
+// Way of the n in set holding tag, -1 if none. Looking up InvalidTag
+// finds the first empty way.
+int
+Cache::FindWay(const uint64_t *set, uint64_t tag, int n)
+{
+	int i = 0;
+#if defined(__AVX2__)
+	__m256i key = _mm256_set1_epi64x(tag);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(set + i)), key);
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+		if (mask)
+			return i + __builtin_ctz(mask);
 	}
+#elif defined(__SSE2__)
+	__m128i key = _mm_set1_epi64x(tag);
+	for (; i + 2 <= n; i += 2)
+	{
+		// no 64-bit compare before SSE4.1: both 32-bit halves must match
+		__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(set + i)), key);
+		eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+		int mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+	for (; i < n; ++i)
+		if (set[i] == tag)
+			return i;
+	return -1;
+}
+
+// MSHR that frees up first
+int
+Cache::MshrFirst()
+{
+	int s = 0;
+	for (int i = 1; i < mshr_num; ++i)
+		if (mshr[i] < mshr[s])
+			s = i;
+	return s;
+}
+
+// MSHRs free at time t
+int
+Cache::MshrFree(uint64_t t)
+{
+	int n = 0;
+	for (int i = 0; i < mshr_num; ++i)
+		if (mshr[i] <= t)
+			n++;
+	return n;
 }
 
 int
 Cache::PrefetchDecision() 
 {
-	return pf_num > 1;
+	return prefetcher != NULL;
 }
 
+// Train on a demand access, then issue what the prefetcher queued as
+// line fills into this cache. Prefetch time is not charged to the access.
 void
-Cache::PrefetchAlgorithm(uint64_t addr) 
+Cache::PrefetchAlgorithm(const MemRequest &req, bool miss, bool pf_hit)
 {
 	int hit, lower_time;
-	uint8_t *buf;
-	buf = new uint8_t[config_.line_size];
-	for (int i = 1; i < pf_num; ++i)
+	uint64_t line;
+	MemRequest pf = req;
+	pf.bytes = config_.line_size;
+	pf.read = 1;
+	pf.type = AccessPrefetch;
+	prefetcher->Access(req.addr / config_.line_size, req.pc, miss, pf_hit, pf_queue);
+	own_prefetch = true;
+	while (pf_queue.Pop(line))
 	{
-		addr += config_.line_size; // next block
-		this->HandleRequest(addr, config_.line_size, 1, buf,
-							hit, lower_time, true);
+		pf_stats.issued++;
+		pf.addr = line * config_.line_size;
+		this->HandleRequest(pf, pf_buf, hit, lower_time);
 	}
-	delete [] buf;
+	own_prefetch = false;
+	if (pf_interval > 1 && pf_stats.fills - pf_mark.fills >= pf_interval)
+		PrefetchThrottle();
+}
+
+// Feedback-directed throttling (Srinath et al., HPCA 2007) on the last
+// interval: inaccurate prefetching backs off, accurate but late
+// prefetching runs further ahead
+void
+Cache::PrefetchThrottle()
+{
+	int fills = pf_stats.fills - pf_mark.fills;
+	int useful = pf_stats.useful - pf_mark.useful;
+	int late = pf_stats.late - pf_mark.late;
+	int degree = prefetcher->Degree();
+
+	if (useful * 100 < fills * PfAccLow)
+		degree--;
+	else if (late * 100 >= useful * PfLateHigh)
+		degree++;
+	if (degree < 1)
+		degree = 1;
+	if (degree > pf_max)
+		degree = pf_max;
+	prefetcher->SetDegree(degree);
+	pf_mark = pf_stats;
 }
 
 void
 Cache::Allocate()
 {
-	int tot = config_.assoc * config_.set_num;
-	lines = new CacheLine[tot];
+	int tot = Lines() + victim_num;
+	tags = new uint64_t[tot];
+	meta = new uint8_t[tot];
+	ready = new uint64_t[tot];
+	if (!tag_only)
+		arena = new uint8_t[(uint64_t)tot * config_.line_size];
 	for (int i = 0; i < tot; ++i)
+		tags[i] = InvalidTag;
+	memset(meta, 0, tot);
+	memset(ready, 0, tot * sizeof(uint64_t));
+	if (arena)
+		memset(arena, 0, (uint64_t)tot * config_.line_size);
+	victim_stamp.assign(victim_num, 0);
+	if ((policy = ReplacePolicy::Create(method, config_.set_num, config_.assoc)) == NULL)
+		panic("[Error] Unknown replace method %d. [Cache::Allocate]\n", method);
+	if ((unsigned)pf_type >= PrefetchTypeNum)
+		panic("[Error] Unknown prefetcher %d. [Cache::Allocate]\n", pf_type);
+	if (pf_num > 1)
+		prefetcher = Prefetcher::Create(pf_type, pf_num - 1, pf_dist);
+	pf_max = PfDegreeMax < config_.set_num ? PfDegreeMax : config_.set_num - 1;
+	if (pf_max < pf_num - 1)
+		pf_max = pf_num - 1;
+	if (prefetcher && !tag_only)
+		pf_buf = new uint8_t[config_.line_size];
+	if ((unsigned)incl >= InclusionNum)
+		panic("[Error] Unknown inclusion policy %d. [Cache::Allocate]\n", incl);
+	if (incl == 1)
+		incl = NON_INCLUSIVE;
+	if ((unsigned)dead_mode >= DeadBlockNum)
+		panic("[Error] Unknown dead block action %d. [Cache::Allocate]\n", dead_mode);
+	if (dead_mode == 1)
+		dead_mode = NO_DEAD_BLOCK;
+	if (dead_mode != NO_DEAD_BLOCK)
+		deadblock = new DeadBlockPredictor(tot);
+	if (mshr_num > 1)
 	{
-		lines[i].last_vis = 0;
-		lines[i].tag = 0;
-		lines[i].valid = false;
-		lines[i].dirty = false;
-		lines[i].inlru = false;
-		lines[i].data = new uint8_t[config_.line_size];
-		memset(lines[i].data, 0, config_.line_size);
+		mshr = new uint64_t[mshr_num];
+		memset(mshr, 0, mshr_num * sizeof(uint64_t));
 	}
-	r_evict = new uint64_t[config_.set_num];
 }
 
 void
@@ -364,10 +938,46 @@ Cache::Print(FILE *fout)
 	fprintf(fout, "- Set Number:        %d\n", config_.set_num);
 	fprintf(fout, "- Associativity:     %d\n", config_.assoc);
 	fprintf(fout, "- Replace Method:    %s\n", cache_method_str[method]);
-	fprintf(fout, "- Prefetch Num:      %d\n", pf_num);
+	if (prefetcher && pf_interval > 1)
+		fprintf(fout, "- Prefetcher:        %s (degree %d, now %d, distance %d)\n",
+				prefetch_type_str[pf_type], pf_num - 1, prefetcher->Degree(), pf_dist);
+	else if (prefetcher)
+		fprintf(fout, "- Prefetcher:        %s (degree %d, distance %d)\n",
+				prefetch_type_str[pf_type], pf_num - 1, pf_dist);
+	else
+		fprintf(fout, "- Prefetcher:        %s\n", prefetch_type_str[NO_PREFETCH]);
 	fprintf(fout, "- Access Times:      %d\n", total);
 	fprintf(fout, "- Miss Times:        %d   (HIT:%d)\n", total - total_hit, total_hit);
 	fprintf(fout, "- Miss Rate:         %.2lf %%\n", (double)(total - total_hit)/total*100);
+	if (pf_stats.issued || pf_stats.fills)
+	{
+		int misses = total - total_hit;
+		fprintf(fout, "- Prefetch Fills:    %d   (ISSUED:%d)\n", pf_stats.fills, pf_stats.issued);
+		fprintf(fout, "- Prefetch Useful:   %d   (LATE:%d)\n", pf_stats.useful, pf_stats.late);
+		fprintf(fout, "- Prefetch Useless:  %d   (EVICTIONS:%d)\n", pf_stats.useless, pf_stats.evictions);
+		fprintf(fout, "- Accuracy:          %.2lf %%\n",
+				pf_stats.fills ? (double)pf_stats.useful/pf_stats.fills*100 : 0);
+		fprintf(fout, "- Coverage:          %.2lf %%\n",
+				pf_stats.useful + misses ? (double)pf_stats.useful/(pf_stats.useful + misses)*100 : 0);
+	}
+	if (mshr)
+	{
+		fprintf(fout, "- MSHRs:             %d\n", mshr_num);
+		fprintf(fout, "- MSHR Merges:       %d   (FULL:%d, PF DROPS:%d)\n", mshr_stats.merges,
+				mshr_stats.full, mshr_stats.drops);
+	}
+	if (incl == INCLUSIVE)
+		fprintf(fout, "- Inclusion:         %s   (BACK-INVAL:%d, DIRTY:%d)\n", inclusion_str[incl],
+				incl_stats.back_inval, incl_stats.back_dirty);
+	else if (incl == EXCLUSIVE)
+		fprintf(fout, "- Inclusion:         %s   (VICTIM FILLS:%d, MOVED UP:%d)\n", inclusion_str[incl],
+				incl_stats.victim_fills, incl_stats.moved_up);
+	if (victim_num)
+		fprintf(fout, "- Victim Cache:      %d lines   (HITS:%d, EVICTIONS:%d)\n", victim_num,
+				victim_stats.hits, victim_stats.evictions);
+	if (deadblock)
+		fprintf(fout, "- Dead Block:        %s   (PREDICTED:%d, BYPASSED:%d, REUSED:%d)\n",
+				dead_block_str[dead_mode], dead_stats.predicted, dead_stats.bypassed, dead_stats.reused);
 	fprintf(fout, "  %s\t[%s]\n", config_.write_through? "[Write Through]":"[Write Back]   ",
 										config_.write_allocate? "Write Alloc":"No-write Alloc");
 }
@@ -2,8 +2,13 @@
 #define CACHE_HEADER
 
 #include "storage.hpp"
+#include "replace.hpp"
+#include "prefetch.hpp"
+#include "deadblock.hpp"
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <vector>
 
 #define GET_CACHE_TAG(addr) \
 	(addr / config_.line_size / config_.set_num)
@@ -30,23 +35,63 @@ typedef struct CacheConfig_
 	int line_size;
 } CacheConfig;
 
-typedef struct CacheLine_
+// Line state is kept as per-line arrays, set-major (line = set * assoc +
+// way), so the tags of a set are contiguous for the vector compare. The
+// victim cache lines follow, their tags are line addresses.
+#define InvalidTag          (~0ull)     // tag of an empty line, never a real tag
+#define LineDirty           1
+#define LinePrefetched      2           // filled by a prefetch, no demand hit yet
+#define LineDead            4           // filled predicted dead, no demand hit yet
+
+typedef struct PrefetchStats_
 {
-	bool valid;
-	bool dirty;
-	bool inlru;
-	int tag;
-	int last_vis;
-	uint8_t *data;
-} CacheLine;
-
-enum CACHE_METHOD
+	int issued; // Requests from the prefetcher of this level
+	int fills; // Lines filled by a prefetch, of this level or above
+	int useful; // First demand hit on a prefetched line
+	int late; // Useful, but the fill was not complete yet
+	int useless; // Prefetched lines evicted unused
+	int evictions; // Valid lines evicted by a prefetch fill
+} PrefetchStats;
+
+// Relation to the levels above, 0|1: neither inclusive nor exclusive
+enum INCLUSION
 {
-	LRU,
-	TWO_QUEUE
+	NON_INCLUSIVE,
+	INCLUSIVE = 2,      // evicting a line invalidates it above
+	EXCLUSIVE           // fills from above pass through, victims from above are installed
 };
 
-extern char *cache_method_str[40];
+#define InclusionNum        4
+
+extern char *inclusion_str[InclusionNum];
+
+typedef struct InclStats_
+{
+	int back_inval; // Lines invalidated above by evictions here
+	int back_dirty; // Evictions here that took newer data from above
+	int victim_fills; // Lines evicted from above installed here
+	int moved_up; // Hits by fills from above, handed up and dropped here
+} InclStats;
+
+typedef struct VictimStats_
+{
+	int hits; // Misses in the sets that hit in the victim cache
+	int evictions; // Lines leaving the victim cache
+} VictimStats;
+
+typedef struct DeadStats_
+{
+	int predicted; // Demand fills predicted dead
+	int bypassed; // Of them, not filled here
+	int reused; // Filled predicted dead, hit anyway
+} DeadStats;
+
+typedef struct MshrStats_
+{
+	int merges; // Demand hits on a line still being filled
+	int full; // Demand fills that waited for a free MSHR
+	int drops; // Prefetches dropped, too few MSHRs free
+} MshrStats;
 
 class Cache: public Storage
 {
@@ -62,37 +107,147 @@ public:
 	}
 	void GetConfig(CacheConfig &cc) { cc = config_; }
 	void SetLower(Storage *ll) { lower_ = ll; }
-	void SetPrefetch(int p) { if (p > 0 && p <= config_.set_num) pf_num = p; }
+	// p - 1 lines per trigger, the demand line counts as one. With
+	// interval > 1 the degree is throttled every interval prefetch fills.
+	void SetPrefetch(PREFETCH_TYPE t, int p, int dist, int interval)
+	{
+		pf_type = t;
+		if (p > 0 && p <= config_.set_num) pf_num = p;
+		if (dist > 0) pf_dist = dist;
+		pf_interval = interval;
+	}
+	// With n > 1 the cache is non-blocking: up to n line fills overlap,
+	// hits go on under them and a hit on a line in flight waits for it
+	void SetMshr(int n) { mshr_num = n; }
+	bool NonBlocking() { return mshr_num > 1; }
+	int HitLatency() { return latency_.bus_latency + latency_.hit_latency; }
+	// Inclusion toward the uppers, victim_fill: the lower cache is
+	// exclusive, clean victims go to it too
+	void SetInclusion(INCLUSION p) { incl = p; }
+	INCLUSION Inclusion() { return incl; }
+	void AddUpper(Cache *c) { uppers.push_back(c); }
+	void SetVictimFill(bool v) { victim_fill = v; }
+	int LineSize() { return config_.line_size; }
+	// Fully associative victim cache of n lines, n <= 1: none
+	void SetVictimCache(int n) { victim_num = n > 1 ? n : 0; }
+	int VictimLines() { return victim_num; }
+	void SetDeadBlock(DEAD_BLOCK d) { dead_mode = d; }
+	// Tags and replacement state only, no line data (trace runs)
+	void SetTagOnly(bool t) { tag_only = t; }
 	void Allocate();
 	// Main access process
-	void HandleRequest(uint64_t addr, int bytes, int read,
-	                 	uint8_t *content, int &hit, int &time,
-	                 	bool prefetching = false);
+	void HandleRequest(const MemRequest &req,
+	                 	uint8_t *content, int &hit, int &time);
+
+	void Warm(uint64_t addr, int read);
+	void WarmVictim(uint64_t addr);
+	// Drop the lines in [addr, addr + bytes) here and in every level above,
+	// dirty bytes are copied to data (data[0] at addr). Returns the lines.
+	int Invalidate(uint64_t addr, int bytes, uint8_t *data, bool &dirty);
+	void ValidLines(std::vector<uint64_t> &addrs);
+	void SyncData(Storage *mem);
+	void WriteBackDirty(Storage *mem);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
 
-	void InfoClear() { total = total_hit = 0; }
+	// Stats and the prefetch timing, request times restart from 0
+	void InfoClear()
+	{
+		total = total_hit = 0;
+		memset(&pf_stats, 0, sizeof pf_stats);
+		pf_mark = pf_stats;
+		pf_busy = 0;
+		memset(&mshr_stats, 0, sizeof mshr_stats);
+		memset(&incl_stats, 0, sizeof incl_stats);
+		memset(&victim_stats, 0, sizeof victim_stats);
+		memset(&dead_stats, 0, sizeof dead_stats);
+		if (ready)
+			memset(ready, 0, (uint64_t)(Lines() + victim_num) * sizeof(uint64_t));
+		if (mshr)
+			memset(mshr, 0, mshr_num * sizeof(uint64_t));
+	}
 	void Print(FILE *fout = NULL);
 	double MissRate() { return (double)(total-total_hit)/total; }
+	int Accesses() { return total; }
+	int Misses() { return total - total_hit; }
 
 private:
-	// Bypassing
-	int BypassDecision(uint64_t addr);
+	// Dead block prediction
+	bool DeadDecision(const MemRequest &req);
 	// Replacement
 	int ReplaceDecision(uint64_t addr);
-	int ReplaceAlgorithm(uint64_t addr);
+	int ReplaceAlgorithm(uint64_t addr, bool distant = false);
+	void Evict(int vic_id, const MemRequest &req, int &time);
+	void Retire(int line, const MemRequest &req, int &time);
+	int WarmInstall(uint64_t addr);
+	void WarmRetire(int line);
+	// Victim cache
+	int VictimFind(uint64_t addr);
+	int VictimSwap(uint64_t addr);
+	int VictimSlot();
+	void VictimMove(int v, int line);
+	// Inclusion
+	bool Exclusive() { return incl == EXCLUSIVE && !uppers.empty(); }
+	void BackInvalidate(int line);
+	void VictimFill(const MemRequest &req, uint8_t *content, int &hit, int &time);
 	// Prefetching
 	int PrefetchDecision();
-	void PrefetchAlgorithm(uint64_t addr);
+	void PrefetchAlgorithm(const MemRequest &req, bool miss, bool pf_hit);
+	void PrefetchThrottle();
+	// MSHRs
+	int MshrFirst();
+	int MshrFree(uint64_t t);
+	// Tag match
+	int FindWay(const uint64_t *set, uint64_t tag, int n);
+	int FindWay(const uint64_t *set, uint64_t tag) { return FindWay(set, tag, config_.assoc); }
+	uint8_t *Data(int line) { return arena ? arena + (uint64_t)line * config_.line_size : NULL; }
+	int Lines() { return config_.assoc * config_.set_num; }
+	uint64_t LineAddr(int line)
+	{
+		return line < Lines() ? GET_CACHE_ADDR(tags[line], line / config_.assoc)
+							  : tags[line] * config_.line_size;
+	}
 
 	CacheConfig config_;
 	Storage *lower_;
 	CACHE_METHOD method;
+	ReplacePolicy *policy;
+	PREFETCH_TYPE pf_type;
+	Prefetcher *prefetcher;     // NULL if not prefetching
+	PrefetchQueue pf_queue;
+	uint8_t *pf_buf;            // one line, target of the prefetch fills
 
-	CacheLine *lines;
-	uint64_t *r_evict;
+	uint64_t *tags;
+	uint8_t *meta;      // LineDirty | LinePrefetched | LineDead
+	uint64_t *ready;    // prefetched lines, all lines if non-blocking: when the fill completes
+	uint8_t *arena;     // line data, line_size bytes per line, NULL if tag_only
+	bool tag_only;
 	int total;
 	int total_hit;
 	int pf_num;
-	bool bypass;
+	int pf_dist;
+	int pf_interval;
+	int pf_max;                 // throttling bound of the degree
+	PrefetchStats pf_stats;
+	PrefetchStats pf_mark;      // pf_stats at the start of the interval
+	int mshr_num;
+	uint64_t *mshr;             // when each MSHR is free again, NULL if blocking
+	MshrStats mshr_stats;
+	INCLUSION incl;
+	std::vector<Cache*> uppers;
+	bool victim_fill;
+	bool own_prefetch;          // in PrefetchAlgorithm, requests are not from above
+	InclStats incl_stats;
+	int victim_num;
+	std::vector<uint64_t> victim_stamp;     // when each victim line was put in, the oldest goes
+	uint64_t victim_clock;
+	VictimStats victim_stats;
+	DEAD_BLOCK dead_mode;
+	DeadBlockPredictor *deadblock;          // NULL if not predicting
+	DeadStats dead_stats;
+	// Prefetch fills queue behind each other on the lower bus, timed on
+	// the request times
+	uint64_t pf_busy;
 	char name[100];
 
 	DISALLOW_COPY_AND_ASSIGN(Cache);
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "machine.hpp"
+#include "checkpoint.hpp"
+#include "utils.hpp"
+
+#define CKPT_PUT(x)		do { if (!CkptWrite(f, &(x), sizeof (x))) return false; } while (0)
+#define CKPT_GET(x)		do { if (!CkptRead(f, &(x), sizeof (x))) return false; } while (0)
+
+// Machine state at a cycle boundary: registers, pipeline latches,
+// counters, page table, allocated pages, valid cache lines and the
+// predictor. The free page list is rebuilt from the page table.
+bool
+Machine::WriteState(FILE *f)
+{
+	uint64_t magic = CkptMagic, num;
+	int version = CkptVersion;
+	CKPT_PUT(magic);
+	CKPT_PUT(version);
+
+	CKPT_PUT(reg);
+	PipelineRegister *pipe[] = {&F_reg, &D_reg, &E_reg, &M_reg, &W_reg,
+								&f_reg, &d_reg, &e_reg, &m_reg};
+	for (int i = 0; i < 9; ++i)
+		CKPT_PUT(*pipe[i]);
+	CKPT_PUT(predict_pc_updated);
+	CKPT_PUT(f_pred_pc);
+	CKPT_PUT(data_forwarded_rs1);
+	CKPT_PUT(data_forwarded_rs2);
+
+	CKPT_PUT(cycCount);
+	CKPT_PUT(cpuCount);
+	CKPT_PUT(instCount);
+	CKPT_PUT(ffCount);
+	CKPT_PUT(commitNext);
+	CKPT_PUT(fetchSeq);
+	CKPT_PUT(fetchRetry);
+	CKPT_PUT(loadHzdCount);
+	CKPT_PUT(ctrlHzdCount);
+	CKPT_PUT(totalBranch);
+	CKPT_PUT(ecallStlCount);
+	CKPT_PUT(jalrStlCount);
+	CKPT_PUT(regReady);
+	CKPT_PUT(memStlCount);
+	CKPT_PUT(brkBase);
+	CKPT_PUT(brkPtr);
+	CKPT_PUT(mmapPtr);
+
+	num = pageTable.size();
+	CKPT_PUT(num);
+	std::map<uint64_t, PageTableEntry*>::iterator it;
+	for (it = pageTable.begin(); it != pageTable.end(); ++it)
+	{
+		PageTableEntry *entry = it->second;
+		CKPT_PUT(entry->vpn);
+		CKPT_PUT(entry->ppn);
+		CKPT_PUT(entry->valid);
+		if (entry->valid && !CkptWrite(f, mainMem->Raw(entry->ppn * PageSize), PageSize))
+			return false;
+	}
+
+	int levels = caches.size();
+	CKPT_PUT(levels);
+	for (size_t i = 0; i < caches.size(); ++i)
+		if (!caches[i]->Save(f))
+			return false;
+
+	return predictor->Save(f);
+}
+
+bool
+Machine::ReadState(FILE *f)
+{
+	uint64_t magic, num;
+	int version;
+	CKPT_GET(magic);
+	CKPT_GET(version);
+	if (magic != CkptMagic || version != CkptVersion)
+	{
+		vprintf("[Error] Not a checkpoint of this version. [ReadState]\n");
+		return false;
+	}
+
+	CKPT_GET(reg);
+	PipelineRegister *pipe[] = {&F_reg, &D_reg, &E_reg, &M_reg, &W_reg,
+								&f_reg, &d_reg, &e_reg, &m_reg};
+	for (int i = 0; i < 9; ++i)
+		CKPT_GET(*pipe[i]);
+	CKPT_GET(predict_pc_updated);
+	CKPT_GET(f_pred_pc);
+	CKPT_GET(data_forwarded_rs1);
+	CKPT_GET(data_forwarded_rs2);
+
+	CKPT_GET(cycCount);
+	CKPT_GET(cpuCount);
+	CKPT_GET(instCount);
+	CKPT_GET(ffCount);
+	CKPT_GET(commitNext);
+	CKPT_GET(fetchSeq);
+	CKPT_GET(fetchRetry);
+	CKPT_GET(loadHzdCount);
+	CKPT_GET(ctrlHzdCount);
+	CKPT_GET(totalBranch);
+	CKPT_GET(ecallStlCount);
+	CKPT_GET(jalrStlCount);
+	CKPT_GET(regReady);
+	CKPT_GET(memStlCount);
+	CKPT_GET(brkBase);
+	CKPT_GET(brkPtr);
+	CKPT_GET(mmapPtr);
+
+	CKPT_GET(num);
+	std::vector<bool> used(physPages, false);
+	pageTable.clear();
+	TlbFlush();
+	for (uint64_t i = 0; i < num; ++i)
+	{
+		PageTableEntry entry;
+		CKPT_GET(entry.vpn);
+		CKPT_GET(entry.ppn);
+		CKPT_GET(entry.valid);
+		if (entry.ppn >= physPages)
+		{
+			vprintf("[Error] Physical page 0x%llx out of bound. [ReadState]\n", entry.ppn);
+			return false;
+		}
+		pte[entry.ppn] = entry;
+		pageTable[entry.vpn] = pte + entry.ppn;
+		used[entry.ppn] = true;
+		if (entry.valid && !CkptRead(f, mainMem->Raw(entry.ppn * PageSize), PageSize))
+			return false;
+	}
+	freePage.Restore(used);
+
+	int levels;
+	CKPT_GET(levels);
+	if (levels != (int)caches.size())
+	{
+		vprintf("[Error] Cache levels differ from checkpoint. [ReadState]\n");
+		return false;
+	}
+	for (size_t i = 0; i < caches.size(); ++i)
+		if (!caches[i]->Load(f))
+			return false;
+
+	return predictor->Load(f);
+}
+
+bool
+Machine::SaveCheckpoint(const char *name)
+{
+	FILE *f = fopen(name, "wb");
+	if (f == NULL)
+	{
+		vprintf("[Error] Cannot open '%s'. [SaveCheckpoint]\n", name);
+		return false;
+	}
+	bool ok = WriteState(f);
+	fclose(f);
+	if (!ok)
+		vprintf("[Error] Short write on '%s'. [SaveCheckpoint]\n", name);
+	return ok;
+}
+
+bool
+Machine::LoadCheckpoint(const char *name)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL)
+	{
+		vprintf("[Error] Cannot open '%s'. [LoadCheckpoint]\n", name);
+		return false;
+	}
+	bool ok = ReadState(f);
+	fclose(f);
+	return ok;
+}
+
+// Trigger by committed inst count or a guest request (ecall a7=5)
+bool
+Machine::CheckpointDue()
+{
+	return ckptPending || (ckptAt && ffCount + instCount >= ckptAt);
+}
+
+void
+Machine::TakeCheckpoint()
+{
+	ckptPending = false;
+	ckptAt = 0;
+	if (SaveCheckpoint(ckptName.c_str()))
+		printf("checkpoint written to '%s' at inst %llu.\n", ckptName.c_str(), ffCount + instCount);
+	else
+		printf("checkpoint to '%s' failed.\n", ckptName.c_str());
+}
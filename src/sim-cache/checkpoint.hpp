@@ -0,0 +1,33 @@
+#ifndef CHECKPOINT_HEADER
+#define CHECKPOINT_HEADER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define CkptMagic           0x31544b4356435352ull   // "RSCVCKT1"
+#define CkptVersion         12
+
+// Raw binary field I/O, false on a short read or write
+inline bool CkptWrite(FILE *f, const void *buf, size_t size)
+{
+	return fwrite(buf, 1, size, f) == size;
+}
+
+inline bool CkptRead(FILE *f, void *buf, size_t size)
+{
+	return fread(buf, 1, size, f) == size;
+}
+
+// Contents of a vector of plain values, sized by the caller
+template <class T> inline bool CkptWriteVec(FILE *f, const std::vector<T> &v)
+{
+	return CkptWrite(f, &v[0], v.size() * sizeof(T));
+}
+
+template <class T> inline bool CkptReadVec(FILE *f, std::vector<T> &v)
+{
+	return CkptRead(f, &v[0], v.size() * sizeof(T));
+}
+
+#endif
@@ -2,7 +2,7 @@
 #include "utils.hpp"
 #include <string.h>
 
-char *valid_cfg_u32[40] =
+char *valid_cfg_u32[64] =
 {
 	"SFT_CYC",
 	"ADD32_CYC",
@@ -25,6 +25,13 @@ char *valid_cfg_u32[40] =
 	"L1C_WA",
 	"L1C_METHOD",
 	"L1C_PREFETCH",
+	"L1C_PF_TYPE",
+	"L1C_PF_DIST",
+	"L1C_PF_INTERVAL",
+	"L1C_MSHR",
+	"L1C_INCL",
+	"L1C_VICTIM",
+	"L1C_DEAD",
 	"L2C_SIZE",
 	"L2C_ASSOC",
 	"L2C_BSIZE",
@@ -32,6 +39,13 @@ char *valid_cfg_u32[40] =
 	"L2C_WA",
 	"L2C_METHOD",
 	"L2C_PREFETCH",
+	"L2C_PF_TYPE",
+	"L2C_PF_DIST",
+	"L2C_PF_INTERVAL",
+	"L2C_MSHR",
+	"L2C_INCL",
+	"L2C_VICTIM",
+	"L2C_DEAD",
 	"L3C_SIZE",
 	"L3C_ASSOC",
 	"L3C_BSIZE",
@@ -39,21 +53,37 @@ char *valid_cfg_u32[40] =
 	"L3C_WA",
 	"L3C_METHOD",
 	"L3C_PREFETCH",
+	"L3C_PF_TYPE",
+	"L3C_PF_DIST",
+	"L3C_PF_INTERVAL",
+	"L3C_MSHR",
+	"L3C_INCL",
+	"L3C_VICTIM",
+	"L3C_DEAD",
+	"ICACHE",
+	"DCACHE",
 };
 
-bool InConfigU32(char *idf, int &id)
+char *cache_key_str[20] =
 {
-	for (int i = 0; i < ConfigU32Num; ++i)
-	{
-		if (strcmp(idf, valid_cfg_u32[i]) == 0)
-		{
-			id = i;
-			return true;
-		}
-	}
-	id = -1;
-	return false;
-}
+	"SIZE",
+	"ASSOC",
+	"BSIZE",
+	"WT",
+	"WA",
+	"METHOD",
+	"PREFETCH",
+	"PF_TYPE",
+	"PF_DIST",
+	"PF_INTERVAL",
+	"MSHR",
+	"INCL",
+	"VICTIM",
+	"DEAD",
+	"HIT_CYC",
+	"BUS_CYC",
+	"LOWER",
+};
 
 Config::Config()
 {
@@ -61,6 +91,13 @@ Config::Config()
 	{
 		u32_cfg[i] = 1;
 	}
+	for (int n = 0; n < CacheNodeMax; ++n)
+	{
+		for (int k = 0; k < CacheKeyNum; ++k)
+			cache_cfg[n][k] = 1;
+		cache_cfg[n][C_LOWER] = n + 2; // the next cache, memory after the last
+	}
+	cacheNum = 0;
 }
 
 Config::~Config()
@@ -88,12 +125,14 @@ Config::LoadConfig(const char *file)
 			(buf[0] == '\\' && buf[1] == '\\'))
 			continue;
 		sscanf(buf, "%[A-Za-z0-9\_]:", idf);
-		if (InConfigU32(idf, id))
+		if ((id = KeyId(idf)) >= 0)
 		{
 			unsigned val;
 			sscanf(buf, "%[A-Za-z0-9\_]:%u", idf, &val);
-			u32_cfg[id] = val;
-			dprintf("config: set u32 config '%s' to value %u\n", valid_cfg_u32[id], val);
+			Value(id) = val;
+			if (id >= ConfigU32Num && (id - ConfigU32Num) / CacheKeyNum >= cacheNum)
+				cacheNum = (id - ConfigU32Num) / CacheKeyNum + 1;
+			dprintf("config: set u32 config '%s' to value %u\n", idf, val);
 		}
 	}
 }
@@ -109,26 +148,127 @@ Config::Print(FILE *fout)
 	{
 		fprintf(fout, "- %s: \t%10u\n", valid_cfg_u32[i], u32_cfg[i]);
 	}
+	for (int n = 0; n < cacheNum; ++n)
+	{
+		for (int k = 0; k < CacheKeyNum; ++k)
+			fprintf(fout, "- C%d_%s: \t%10u\n", n + 1, cache_key_str[k], cache_cfg[n][k]);
+	}
 	fprintf(fout,   "----------------------------------------\n");
 }
 
 unsigned
-Config::GetConfig(char *name)
+Config::GetConfig(const char *name)
+{
+	int id = KeyId(name);
+	if (id == -1)
+	{
+		printf("[Warning] config: Cannot find config '%s'.\n", name);
+		return -1;
+	}
+
+	return Value(id);
+}
+
+int
+Config::KeyId(const char *name)
 {
-	int id = -1;
 	for (int i = 0; i < ConfigU32Num; ++i)
 	{
 		if (strcmp(name, valid_cfg_u32[i]) == 0)
+			return i;
+	}
+
+	int n, len = 0;
+	if (sscanf(name, "C%d_%n", &n, &len) != 1 || len == 0 || n < 1 || n > CacheNodeMax)
+		return -1;
+	for (int k = 0; k < CacheKeyNum; ++k)
+	{
+		if (strcmp(name + len, cache_key_str[k]) == 0)
+			return ConfigU32Num + (n - 1) * CacheKeyNum + k;
+	}
+	return -1;
+}
+
+unsigned &
+Config::Value(int id)
+{
+	if (id < ConfigU32Num)
+		return u32_cfg[id];
+	id -= ConfigU32Num;
+	return cache_cfg[id / CacheKeyNum][id % CacheKeyNum];
+}
+
+// Without C1_* keys the caches are the L1C/L2C/L3C chain of cacheLevel
+// levels, shared by instructions and data. Levels are counted from the
+// top, a cache only reached from ICACHE or DCACHE gets an I or D suffix,
+// one reached from several upper caches is shared by them.
+bool
+Config::Hierarchy(int cacheLevel, std::vector<CacheNode> &nodes, int &inst, int &data)
+{
+	nodes.clear();
+	if (cacheNum == 0)
+	{
+		for (int l = 0; l < cacheLevel; ++l)
 		{
-			id = i;
-			break;
+			char prefix[10];
+			snprintf(prefix, 10, "L%dC_", l + 1);
+			nodes.push_back(CacheNode());
+			nodes[l].prefix = prefix;
+			nodes[l].lower = l + 1 < cacheLevel ? l + 1 : -1;
 		}
+		inst = data = cacheLevel > 0 ? 0 : -1;
 	}
-	if (id == -1)
+	else
 	{
-		printf("[Warning] config: Cannot find config '%s'.\n", name);
-		return -1;
+		for (int n = 0; n < cacheNum; ++n)
+		{
+			char prefix[10];
+			unsigned lo = cache_cfg[n][C_LOWER];
+			snprintf(prefix, 10, "C%d_", n + 1);
+			// the default of the last cache, the one past it, is memory
+			if (n + 1 == cacheNum && lo == (unsigned)cacheNum + 1)
+				lo = 0;
+			if (lo != 0 && (lo <= (unsigned)n + 1 || lo > (unsigned)cacheNum))
+			{
+				printf("[Error] config: C%d_LOWER must be 0 or %d .. %d.\n", n + 1, n + 2, cacheNum);
+				return false;
+			}
+			nodes.push_back(CacheNode());
+			nodes[n].prefix = prefix;
+			nodes[n].lower = lo == 0 ? -1 : lo - 1;
+		}
+		if (u32_cfg[ICACHE] > (unsigned)cacheNum || u32_cfg[DCACHE] > (unsigned)cacheNum)
+		{
+			printf("[Error] config: ICACHE and DCACHE must be 0 .. %d.\n", cacheNum);
+			return false;
+		}
+		inst = (int)u32_cfg[ICACHE] - 1;
+		data = (int)u32_cfg[DCACHE] - 1;
 	}
 
-	return u32_cfg[id];
+	// lower levels have larger indices, so one pass top-down settles both
+	std::vector<int> level(nodes.size(), 1), side(nodes.size(), 0);
+	if (inst >= 0) side[inst] |= 1;
+	if (data >= 0) side[data] |= 2;
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		if (side[n] == 0)
+		{
+			printf("[Error] config: C%d is reached from neither ICACHE nor DCACHE.\n", (int)n + 1);
+			return false;
+		}
+		int lo = nodes[n].lower;
+		if (lo < 0)
+			continue;
+		if (level[lo] < level[n] + 1)
+			level[lo] = level[n] + 1;
+		side[lo] |= side[n];
+	}
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		char label[10];
+		snprintf(label, 10, "L%d%s", level[n], side[n] == 1 ? "I" : side[n] == 2 ? "D" : "");
+		nodes[n].label = label;
+	}
+	return true;
 }
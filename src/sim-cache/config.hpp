@@ -2,10 +2,15 @@
 #define CONFIG_HEADER
 
 #include <stdio.h>
+#include <string>
+#include <vector>
 
-extern char *valid_cfg_u32[40];
+extern char *valid_cfg_u32[64];
+extern char *cache_key_str[20];
 
-#define ConfigU32Num		35
+#define ConfigU32Num		58
+#define CacheNodeMax		8		// C1_* .. C8_* caches of the hierarchy graph
+#define CacheKeyNum			17
 
 enum CFG_U32
 {
@@ -29,7 +34,14 @@ enum CFG_U32
 	L1C_WT,
 	L1C_WA,
 	L1C_METHOD,
-	L1C_PREFETCH,
+	L1C_PREFETCH,		// prefetch degree + 1, 1: off
+	L1C_PF_TYPE,		// PREFETCH_TYPE
+	L1C_PF_DIST,		// deltas ahead of the trigger
+	L1C_PF_INTERVAL,	// prefetch fills per throttling interval, 0|1: off
+	L1C_MSHR,			// outstanding line fills, 0|1: blocking
+	L1C_INCL,			// INCLUSION toward the levels above, 0|1: neither
+	L1C_VICTIM,			// victim cache lines, 0|1: none
+	L1C_DEAD,			// DEAD_BLOCK action on predicted dead fills, 0|1: off
 	L2C_SIZE,
 	L2C_ASSOC,
 	L2C_BSIZE,
@@ -37,25 +49,80 @@ enum CFG_U32
 	L2C_WA,
 	L2C_METHOD,
 	L2C_PREFETCH,
+	L2C_PF_TYPE,
+	L2C_PF_DIST,
+	L2C_PF_INTERVAL,
+	L2C_MSHR,
+	L2C_INCL,
+	L2C_VICTIM,
+	L2C_DEAD,
 	L3C_SIZE,
 	L3C_ASSOC,
 	L3C_BSIZE,
 	L3C_WT,
 	L3C_WA,
 	L3C_METHOD,
-	L3C_PREFETCH
+	L3C_PREFETCH,
+	L3C_PF_TYPE,
+	L3C_PF_DIST,
+	L3C_PF_INTERVAL,
+	L3C_MSHR,
+	L3C_INCL,
+	L3C_VICTIM,
+	L3C_DEAD,
+	ICACHE,				// cache n of the fetch unit, 0: memory (with C1_*)
+	DCACHE				// cache n of loads and stores, 0: memory (with C1_*)
+};
+
+// Keys of one hierarchy cache, prefixed by C<n>_
+enum CFG_CACHE
+{
+	C_SIZE,
+	C_ASSOC,
+	C_BSIZE,
+	C_WT,
+	C_WA,
+	C_METHOD,
+	C_PREFETCH,
+	C_PF_TYPE,
+	C_PF_DIST,
+	C_PF_INTERVAL,
+	C_MSHR,
+	C_INCL,
+	C_VICTIM,
+	C_DEAD,
+	C_HIT_CYC,
+	C_BUS_CYC,
+	C_LOWER				// next level n, larger than its own, 0: memory
+};
+
+// One cache of the hierarchy, its keys are prefix + cache_key_str
+class CacheNode
+{
+public:
+	std::string label;	// L1, L1I, L2, ...
+	std::string prefix;	// C1_, or L1C_ for the fixed chain
+	int lower;			// index of the next level, -1: memory
 };
 
 class Config
 {
 public:
 	unsigned u32_cfg[ConfigU32Num];
+	unsigned cache_cfg[CacheNodeMax][CacheKeyNum];
+	int cacheNum;		// C1_* .. C<cacheNum>_* given, 0: L1C/L2C/L3C chain
 
 	Config();
 	~Config();
 	void LoadConfig(const char *file);
 	void Print(FILE *fout = NULL);
-	unsigned GetConfig(char *name);
+	unsigned GetConfig(const char *name);
+	// ids below ConfigU32Num index u32_cfg, the rest cache_cfg
+	int KeyId(const char *name);
+	unsigned &Value(int id);
+	// Caches top-down, each before its lower levels. inst, data: the
+	// cache index the fetch and load/store units access, -1: memory
+	bool Hierarchy(int cacheLevel, std::vector<CacheNode> &nodes, int &inst, int &data);
 };
 
 #endif
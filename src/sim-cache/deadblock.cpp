@@ -0,0 +1,63 @@
+#include "deadblock.hpp"
+#include "checkpoint.hpp"
+
+char *dead_block_str[DeadBlockNum] =
+{
+	"NONE",
+	"NONE",
+	"DISTANT",
+	"BYPASS"
+};
+
+DeadBlockPredictor::DeadBlockPredictor(int lines)
+: ctr(DeadTableSize, DeadCtrInit), sigs(lines, 0), reused(lines, 1)
+{
+}
+
+uint16_t
+DeadBlockPredictor::Signature(uint64_t pc, uint64_t addr)
+{
+	uint64_t s = pc ? pc >> 2 : addr >> DeadRegionShift;
+	return (s ^ (s >> 12) ^ (s >> 24)) % DeadTableSize;
+}
+
+void
+DeadBlockPredictor::Hit(int line)
+{
+	if (reused[line])
+		return;
+	reused[line] = 1;
+	if (ctr[sigs[line]] < DeadCtrMax)
+		ctr[sigs[line]]++;
+}
+
+void
+DeadBlockPredictor::Evict(int line)
+{
+	if (!reused[line] && ctr[sigs[line]] > 0)
+		ctr[sigs[line]]--;
+	reused[line] = 1;
+}
+
+void
+DeadBlockPredictor::Swap(int a, int b)
+{
+	uint16_t s = sigs[a];
+	uint8_t r = reused[a];
+	sigs[a] = sigs[b];
+	reused[a] = reused[b];
+	sigs[b] = s;
+	reused[b] = r;
+}
+
+bool
+DeadBlockPredictor::Save(FILE *f)
+{
+	return CkptWriteVec(f, ctr) && CkptWriteVec(f, sigs) && CkptWriteVec(f, reused);
+}
+
+bool
+DeadBlockPredictor::Load(FILE *f)
+{
+	return CkptReadVec(f, ctr) && CkptReadVec(f, sigs) && CkptReadVec(f, reused);
+}
@@ -0,0 +1,53 @@
+#ifndef DEADBLOCK_HEADER
+#define DEADBLOCK_HEADER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define DeadBlockNum        4
+#define DeadTableSize       4096        // signature counters
+#define DeadCtrMax          7           // 3-bit counters, 0: predicted dead
+#define DeadCtrInit         1
+#define DeadSamplePeriod    32          // one set per period ignores the predictions
+#define DeadRegionShift     16          // no pc (traces): the 64KB region is the signature
+
+// Action on a demand fill predicted dead, 0|1: no prediction
+enum DEAD_BLOCK
+{
+	NO_DEAD_BLOCK,
+	DEAD_DISTANT = 2,   // inserted as the next victim of its set
+	DEAD_BYPASS         // not filled here, the data goes straight up
+};
+
+extern char *dead_block_str[DeadBlockNum];
+
+// Signature-based hit predictor (SHiP, Wu et al., MICRO 2011). Each line
+// keeps the signature it was filled under: its first hit trains the
+// signature live, an eviction without a hit trains it dead.
+class DeadBlockPredictor
+{
+public:
+	DeadBlockPredictor(int lines);
+
+	// pc >> 2, or the address region if the access has no pc
+	static uint16_t Signature(uint64_t pc, uint64_t addr);
+
+	bool Dead(uint16_t sig) { return ctr[sig] == 0; }
+	void Fill(int line, uint16_t sig) { sigs[line] = sig; reused[line] = 0; }
+	// line is not trained on (filled while warming)
+	void Forget(int line) { reused[line] = 1; }
+	void Hit(int line);
+	void Evict(int line);
+	void Swap(int a, int b);
+
+	bool Save(FILE *f);
+	bool Load(FILE *f);
+
+private:
+	std::vector<uint8_t> ctr;
+	std::vector<uint16_t> sigs;     // per line
+	std::vector<uint8_t> reused;    // per line, hit since the fill
+};
+
+#endif
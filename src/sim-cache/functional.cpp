@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <string.h>
+#include "machine.hpp"
+#include "utils.hpp"
+
+// Functional access straight to main memory, with warm the cache
+// hierarchy sees the access as a tag-only update
+int
+Machine::FuncMem(uint64_t addr, int size, int read, uint64_t *value, bool warm, MemAccess type)
+{
+	uint64_t p_addr;
+
+	if (!Translate(addr, &p_addr, size))
+	{
+		vprintf("--Translate error. [FuncMem]\n");
+		return false;
+	}
+	if (p_addr + size > mainMem->Size())
+	{
+		vprintf("[Error] Physical address out of bound. [FuncMem]\n");
+		return false;
+	}
+
+	if (warm)
+		(type == AccessFetch ? instStorage : topStorage)->Warm(p_addr, read);
+
+	// the TLB entry filled by Translate points at the page in main memory
+	uint8_t *host = tlb[(addr / PageSize) & (TlbSize - 1)].host + addr % PageSize;
+	if (read)
+	{
+		*value = 0;
+		memcpy(value, host, size);
+	}
+	else
+		memcpy(host, value, size);
+	return true;
+}
+
+// Execute the inst at P_PCReg to completion, no pipeline and no timing
+bool
+Machine::FuncStep(bool warm)
+{
+	uint64_t pc = ReadReg(P_PCReg), next = pc + 4, data;
+	Instruction inst;
+
+	inst.adr = pc;
+	if (!FuncMem(pc, 4, 1, &data, warm, AccessFetch))
+	{
+		vprintf("--Can not fetch operation. [FuncStep]\n");
+		return false;
+	}
+	inst.value = data;
+
+	Instruction *cached = decodeCache + ((pc >> 2) & (DecodeCacheSize - 1));
+	if (cached->adr == pc && cached->value == inst.value)
+		inst = *cached;
+	else
+	{
+		if (!inst.Decode())
+			return false;
+		*cached = inst;
+	}
+
+	int64_t val_a = ReadReg(inst.rs1), val_b = ReadReg(inst.rs2), val_e = 0;
+	int64_t imm = inst.imm;
+	int size = 0;
+	bool taken = false, branch = false;
+
+	switch (inst.optype)
+	{
+		case Op_add:	val_e = val_a + val_b; break;
+		case Op_mul:	val_e = val_a * val_b; break;
+		case Op_sub:	val_e = val_a - val_b; break;
+		case Op_sll:	val_e = val_a << val_b; break;
+		case Op_mulh:	val_e = (int64_t)(((__int128_t)val_a * (__int128_t)val_b) >> 64); break;
+		case Op_slt:	val_e = val_a < val_b? 1 : 0; break;
+		case Op_sltu:	val_e = (uint64_t)val_a < (uint64_t)val_b? 1 : 0; break;
+		case Op_xor:	val_e = val_a ^ val_b; break;
+		case Op_div:	val_e = val_a / val_b; break;
+		case Op_srl:	val_e = (int64_t)((uint64_t)val_a >> val_b); break;
+		case Op_sra:	val_e = val_a >> val_b; break;
+		case Op_or:		val_e = val_a | val_b; break;
+		case Op_rem:	val_e = val_a % val_b; break;
+		case Op_and:	val_e = val_a & val_b; break;
+		case Op_addw:	val_e = (int64_t)((int32_t)(val_a + val_b)); break;
+		case Op_subw:	val_e = (int64_t)((int32_t)(val_a - val_b)); break;
+		case Op_sllw:	val_e = (int64_t)((int32_t)val_a << val_b); break;
+		case Op_srlw:	val_e = (uint64_t)((uint32_t)val_a >> val_b); break;
+		case Op_sraw:	val_e = (int64_t)((int32_t)val_a >> val_b); break;
+
+		case Op_addi:	val_e = val_a + imm; break;
+		case Op_slli:	val_e = val_a << (imm & 0x3f); break;
+		case Op_slti:	val_e = val_a < imm? 1 : 0; break;
+		case Op_sltiu:	val_e = (uint64_t)val_a < (uint64_t)imm? 1 : 0; break;
+		case Op_xori:	val_e = val_a ^ imm; break;
+		case Op_srli:	val_e = (int64_t)((uint64_t)val_a >> (imm & 0x3f)); break;
+		case Op_srai:	val_e = val_a >> (imm & 0x3f); break;
+		case Op_ori:	val_e = val_a | imm; break;
+		case Op_andi:	val_e = val_a & imm; break;
+		case Op_addiw:	val_e = (int64_t)((int32_t)(val_a + imm)); break;
+		case Op_slliw:	val_e = (int64_t)((int32_t)val_a << (imm & 0x1f)); break;
+		case Op_srliw:	val_e = (uint64_t)((uint32_t)val_a >> (imm & 0x1f)); break;
+		case Op_sraiw:	val_e = (int64_t)((int32_t)val_a >> (imm & 0x1f)); break;
+		case Op_auipc:	val_e = pc + imm; break;
+		case Op_lui:	val_e = imm; break;
+
+		case Op_lb: case Op_lbu: size = 1; goto LOAD;
+		case Op_lh: case Op_lhu: size = 2; goto LOAD;
+		case Op_lw: case Op_lwu: size = 4; goto LOAD;
+		case Op_ld: size = 8;
+		LOAD:
+			if (!FuncMem(val_a + imm, size, 1, &data, warm))
+			{
+				vprintf("--Memory access error. [FuncStep]\n");
+				return false;
+			}
+			switch (inst.optype)
+			{
+				case Op_lb:		val_e = (int64_t)((int8_t)data); break;
+				case Op_lh:		val_e = (int64_t)((int16_t)data); break;
+				case Op_lw:		val_e = (int64_t)((int32_t)data); break;
+				default:		val_e = (int64_t)data; break;
+			}
+			break;
+
+		case Op_sb: size = 1; goto STORE;
+		case Op_sh: size = 2; goto STORE;
+		case Op_sw: size = 4; goto STORE;
+		case Op_sd: size = 8;
+		STORE:
+			data = val_b;
+			if (!FuncMem(val_a + imm, size, 0, &data, warm))
+			{
+				vprintf("--Memory access error. [FuncStep]\n");
+				return false;
+			}
+			break;
+
+		case Op_beq:	taken = val_a == val_b; branch = true; break;
+		case Op_bne:	taken = val_a != val_b; branch = true; break;
+		case Op_blt:	taken = val_a < val_b; branch = true; break;
+		case Op_bge:	taken = val_a >= val_b; branch = true; break;
+		case Op_bltu:	taken = (uint64_t)val_a < (uint64_t)val_b; branch = true; break;
+		case Op_bgeu:	taken = (uint64_t)val_a >= (uint64_t)val_b; branch = true; break;
+
+		case Op_jal:
+			val_e = pc + 4;
+			next = pc + imm;
+			break;
+		case Op_jalr:
+			val_e = pc + 4;
+			next = (val_a + imm) & (-1ll ^ 0x1);
+			break;
+		case Op_ecall:
+			if (!Syscall(true))
+				return false;
+			break;
+
+		default:
+			vprintf("[Error] Unknown optype %d. [FuncStep]\n", inst.optype);
+			return false;
+	}
+
+	if (branch)
+	{
+		// same training rule as the pipeline: update on a mispredict
+		if (warm && predictor->Predict(pc) != taken)
+			predictor->Update(pc, taken);
+		if (taken)
+			next = pc + imm;
+	}
+	else if (inst.type != Stype && inst.optype != Op_ecall)
+	{
+		WriteReg(inst.rd, val_e);
+		WriteReg(ZeroReg, 0);
+	}
+
+	WriteReg(PCReg, pc);
+	WriteReg(P_PCReg, next);
+	return true;
+}
+
+// Run num insts functionally from a drained pipeline; with warm the
+// caches and predictor carry their state into the next detailed part
+void
+Machine::FastForward(uint64_t num, bool warm)
+{
+	Timer timer;
+	vprintf("***** fast-forward %llu insts%s\n", num, warm ? " (warming)" : "");
+
+	for (uint64_t i = 0; i < num && !halted; i++)
+	{
+		if (!FuncStep(warm))
+		{
+			panic("Fast-forward error!\n");
+		}
+		ffCount++;
+
+		if (CheckpointDue())
+		{
+			SyncCaches();
+			TakeCheckpoint();
+		}
+	}
+
+	// warmed lines only hold tags so far
+	if (warm)
+		SyncCaches();
+	vprintf("***** fast-forward end [%.2lf]\n\n", timer.Finish());
+}
+
+// Reload cache data from main memory after functional execution
+void
+Machine::SyncCaches()
+{
+	for (size_t i = 0; i < caches.size(); ++i)
+		caches[i]->SyncData(mainMem);
+}
+
+// Make main memory current before functional execution, upper levels
+// hold the newest copy so they are written last
+void
+Machine::FlushCaches()
+{
+	for (int i = caches.size() - 1; i >= 0; --i)
+		caches[i]->WriteBackDirty(mainMem);
+}
+
+void
+Machine::ResetStats()
+{
+	cycCount = 0;
+	cpuCount = 0;
+	instCount = 0;
+	runTime = .0;
+
+	loadHzdCount = 0;
+	ctrlHzdCount = 0;
+	ecallStlCount = 0;
+	jalrStlCount = 0;
+	totalBranch = 0;
+	memStlCount = 0;
+	memset(regReady, 0, sizeof regReady);
+
+	for (size_t i = 0; i < caches.size(); ++i)
+		caches[i]->InfoClear();
+}
@@ -0,0 +1,63 @@
+#include "image.hpp"
+#include "machine.hpp"
+#include "utils.hpp"
+
+#include <elfio/elfio.hpp>
+
+bool
+ElfImage::Load(const char *name)
+{
+	ELFIO::elfio elf;
+	if (!elf.load(name) || elf.get_machine() != EM_RISCV)
+		return false;
+
+	entry = elf.get_entry();
+	segs.clear();
+	for (int i = 0; i < elf.segments.size(); ++i)
+	{
+		const ELFIO::segment *pseg = elf.segments[i];
+		ImageSegment s;
+		s.adr = pseg->get_virtual_address();
+		s.memSize = pseg->get_memory_size();
+		if (pseg->get_file_size())
+			s.data.assign((const uint8_t*)pseg->get_data(),
+						  (const uint8_t*)pseg->get_data() + pseg->get_file_size());
+		segs.push_back(s);
+	}
+	return true;
+}
+
+// Segments, heap start, entry and the initial stack
+bool
+ElfImage::Apply(Machine *machine) const
+{
+	for (size_t i = 0; i < segs.size(); ++i)
+	{
+		const ImageSegment &s = segs[i];
+
+		// heap starts on the page after the highest segment
+		uint64_t brk = (s.adr + s.memSize + PageSize - 1) / PageSize * PageSize;
+		if (brk > machine->brkBase)
+			machine->brkBase = machine->brkPtr = brk;
+
+		// whole pages at once, the BSS tail is zero-filled
+		if (!machine->LoadSegment(s.adr, s.data.empty() ? NULL : &s.data[0], s.data.size(), s.memSize))
+		{
+			vprintf("[Error] Can not load segment at 0x%llx. [ElfImage::Apply]\n", s.adr);
+			return false;
+		}
+	}
+
+	// pipeline - predict pc
+	machine->WriteReg(P_PCReg, entry);
+
+	// stack initialization
+	machine->WriteReg(SPReg, StackTopPtr - 8);
+	uint64_t vpn = (StackTopPtr / PageSize) - 1;
+	for (int i = 0; i < StackPageNum; i++, vpn--)
+	{
+		machine->AllocatePage(vpn);
+	}
+	machine->WriteMem(StackTopPtr - 8, 8, 0xdeadbeefdeadbeefll, true);
+	return true;
+}
@@ -0,0 +1,29 @@
+#ifndef IMAGE_HEADER
+#define IMAGE_HEADER
+
+#include <stdint.h>
+#include <vector>
+
+class Machine;
+
+class ImageSegment
+{
+public:
+	uint64_t adr;
+	uint64_t memSize;
+	std::vector<uint8_t> data;  // file bytes, the rest up to memSize is BSS
+};
+
+// Loadable segments and entry of a RISC-V ELF, read once and copied into
+// any number of machines
+class ElfImage
+{
+public:
+	bool Load(const char *name);
+	bool Apply(Machine *machine) const;
+
+	uint64_t entry;
+	std::vector<ImageSegment> segs;
+};
+
+#endif
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unordered_set>
 #include "machine.hpp"
 #include "utils.hpp"
 
@@ -10,7 +12,7 @@ void SingleStepInfo()
 	printf("Single Step Mode Help:\n");
 	printf("c: continue\n");
 	printf("r: print all registers\n");
-	printf("d: dump machine status to file 'status_dump.txt'\n");
+	printf("d: dump machine status to file 'status_dump.txt' and a checkpoint to 'status_dump.ckpt'\n");
 	printf("p: print page table\n");
 	printf("m <address/hex> <size/dec>: get data from address\n");
 	printf("q: quit\n\n");
@@ -36,6 +38,8 @@ Machine::SingleStepDebug()
 				dump_out = fopen("status_dump.txt", "w");
 				Status(dump_out);
 				fclose(dump_out);
+				if (!SaveCheckpoint("status_dump.ckpt"))
+					printf("checkpoint failed.\n");
 				break;
 			case 'p':
 				PrintPageTable();
@@ -71,189 +75,272 @@ Machine::Machine(PRED_TYPE mode)
 	// register initialization
 	memset(reg, 0, sizeof reg);
 
-	// page table initialization
-	for (int i = 0; i < PhysicalPageNum; ++i)
-		freePage.push(i);
-	pte = new PageTableEntry[PhysicalPageNum];
+	// physical memory and page table come with StorageInit
+	physPages = PhysicalPageNum;
+	pte = NULL;
+	mainMem = NULL;
+	TlbFlush();
 
 	predictor = new Predictor(mode);
 
+	// decoded instruction cache, odd address marks an empty entry
+	decodeCache = new Instruction[DecodeCacheSize];
+	for (int i = 0; i < DecodeCacheSize; ++i)
+		decodeCache[i].adr = 1;
+
 	cycCount = 0;
 	cpuCount = 0;
 	instCount = 0;
 	runTime = .0;
+	halted = false;
+	draining = false;
+	commitNext = 0;
+	fetchSeq = 0;
+	fetchRetry = false;
+	quiet = false;
+	predict_pc_updated = false;
+	f_pred_pc = 0;
+	data_forwarded_rs1 = data_forwarded_rs2 = false;
+	trace = NULL;
+	ckptAt = 0;
+	ckptPending = false;
+	ckptName = "machine.ckpt";
+	ffCount = 0;
+	brkBase = brkPtr = 0;
+	mmapPtr = MmapTopPtr;
 
     loadHzdCount = 0;
     ctrlHzdCount = 0;
     ecallStlCount = 0;
     jalrStlCount = 0;
     totalBranch = 0;
+    loadHitCyc = 0;
+    memStlCount = 0;
+    memset(regReady, 0, sizeof regReady);
 
-    l1cache = NULL;
-    l2cache = NULL;
-    l3cache = NULL;
+    topStorage = instStorage = NULL;
 }
 
 Machine::~Machine()
 {
 	delete mainMem;
-	delete l1cache;
+	for (size_t i = 0; i < caches.size(); ++i)
+		delete caches[i];
 
-	delete pte;
+	if (pte)
+		munmap(pte, physPages * sizeof(PageTableEntry));
 	delete predictor;
+	delete [] decodeCache;
+	delete trace;
+}
+
+// Cache keys are node.prefix + SIZE, ASSOC, ...
+static Cache *
+NewCache(Config &cfg, const CacheNode &node, bool tagOnly)
+{
+	std::string key[CacheKeyNum];
+	for (int k = 0; k < CacheKeyNum; ++k)
+		key[k] = node.prefix + cache_key_str[k];
+	std::string name = node.label + " cache";
+
+	StorageLatency ll;
+	StorageStats s;
+	CacheConfig cc;
+	s.access_time = 0;
+
+	Cache *c = new Cache((char*)name.c_str(), (CACHE_METHOD)cfg.GetConfig(key[C_METHOD].c_str()));
+	c->SetStats(s);
+	ll.bus_latency = cfg.GetConfig(key[C_BUS_CYC].c_str());
+	ll.hit_latency = cfg.GetConfig(key[C_HIT_CYC].c_str());
+	c->SetLatency(ll);
+
+	cc.size = cfg.GetConfig(key[C_SIZE].c_str());
+	cc.assoc = cfg.GetConfig(key[C_ASSOC].c_str());
+	cc.line_size = cfg.GetConfig(key[C_BSIZE].c_str()); // Size of cache line
+	cc.write_through = (bool)cfg.GetConfig(key[C_WT].c_str()); // 0|1 for back|through
+	cc.write_allocate = (bool)cfg.GetConfig(key[C_WA].c_str()); // 0|1 for no-alc|alc
+	c->SetConfig(cc);
+	c->SetTagOnly(tagOnly);
+	c->SetPrefetch((PREFETCH_TYPE)cfg.GetConfig(key[C_PF_TYPE].c_str()),
+					cfg.GetConfig(key[C_PREFETCH].c_str()), cfg.GetConfig(key[C_PF_DIST].c_str()),
+					cfg.GetConfig(key[C_PF_INTERVAL].c_str()));
+	c->SetMshr(cfg.GetConfig(key[C_MSHR].c_str()));
+	c->SetInclusion((INCLUSION)cfg.GetConfig(key[C_INCL].c_str()));
+	c->SetVictimCache(cfg.GetConfig(key[C_VICTIM].c_str()));
+	c->SetDeadBlock((DEAD_BLOCK)cfg.GetConfig(key[C_DEAD].c_str()));
+	c->Allocate();
+	return c;
 }
 
-void Machine::StorageInit(int cacheLevel)
+void Machine::StorageInit(int cacheLevel, bool tagOnly)
 {
 	// storage initialization
     StorageLatency ll;
     StorageStats s;
-    CacheConfig l1c;
     s.access_time = 0;
 
-    mainMem = new Memory();
+    // physical memory and page table, both untouched until pages are used
+    mainMem = new Memory(physPages * PageSize);
+    pte = (PageTableEntry*)mmap(NULL, physPages * sizeof(PageTableEntry), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pte == MAP_FAILED)
+        panic("[Error] Can not reserve the page table. [StorageInit]\n");
+    freePage.Reset(physPages);
+
     mainMem->SetStats(s);
     ll.bus_latency = 0;
     ll.hit_latency = cfg.GetConfig("MEM_CYC");
     mainMem->SetLatency(ll);
 
-	if (cacheLevel > 2)
-	{
-	    l3cache = new Cache("L3 cache", (CACHE_METHOD)cfg.GetConfig("L3C_METHOD"));
-	    l3cache->SetStats(s);
-	    ll.bus_latency = cfg.GetConfig("L3C_BUS_CYC");
-	    ll.hit_latency = cfg.GetConfig("L3C_HIT_CYC");
-	    l3cache->SetLatency(ll);
-
-	    l1c.size = cfg.GetConfig("L3C_SIZE");
-	    l1c.assoc = cfg.GetConfig("L3C_ASSOC");
-	    l1c.line_size = cfg.GetConfig("L3C_BSIZE"); // Size of cache line
-	    l1c.write_through = (bool)cfg.GetConfig("L3C_WT"); // 0|1 for back|through
-	    l1c.write_allocate = (bool)cfg.GetConfig("L3C_WA"); // 0|1 for no-alc|alc
-	    l3cache->SetConfig(l1c);
-    	l3cache->SetPrefetch(cfg.GetConfig("L3C_PREFETCH"));
-	    l3cache->Allocate();
-    	l3cache->SetLower(mainMem);
-	}
-    if (cacheLevel > 1)
-    {
-	    l2cache = new Cache("L2 cache", (CACHE_METHOD)cfg.GetConfig("L2C_METHOD"));
-	    l2cache->SetStats(s);
-	    ll.bus_latency = cfg.GetConfig("L2C_BUS_CYC");
-	    ll.hit_latency = cfg.GetConfig("L2C_HIT_CYC");
-	    l2cache->SetLatency(ll);
-
-	    l1c.size = cfg.GetConfig("L2C_SIZE");
-	    l1c.assoc = cfg.GetConfig("L2C_ASSOC");
-	    l1c.line_size = cfg.GetConfig("L2C_BSIZE"); // Size of cache line
-	    l1c.write_through = (bool)cfg.GetConfig("L2C_WT"); // 0|1 for back|through
-	    l1c.write_allocate = (bool)cfg.GetConfig("L2C_WA"); // 0|1 for no-alc|alc
-	    l2cache->SetConfig(l1c);
-    	l2cache->SetPrefetch(cfg.GetConfig("L2C_PREFETCH"));
-	    l2cache->Allocate();
-	    if (cacheLevel > 2)
-    		l2cache->SetLower(l3cache);
-    	else
-    		l2cache->SetLower(mainMem);
-    }
-    if (cacheLevel > 0)
+    // the cache graph, lower levels first
+    int inst, data;
+    if (!cfg.Hierarchy(cacheLevel, layout, inst, data))
+        panic("[Error] Bad cache hierarchy in the config. [StorageInit]\n");
+    caches.assign(layout.size(), NULL);
+    for (int i = layout.size() - 1; i >= 0; --i)
     {
-    	l1cache = new Cache("L1 cache", (CACHE_METHOD)cfg.GetConfig("L1C_METHOD"));
-    	l1cache->SetStats(s);
-	    ll.bus_latency = cfg.GetConfig("L1C_BUS_CYC");
-	    ll.hit_latency = cfg.GetConfig("L1C_HIT_CYC");
-	    l1cache->SetLatency(ll);
-
-	    l1c.size = cfg.GetConfig("L1C_SIZE");
-	    l1c.assoc = cfg.GetConfig("L1C_ASSOC");
-	    l1c.line_size = cfg.GetConfig("L1C_BSIZE"); // Size of cache line
-	    l1c.write_through = (bool)cfg.GetConfig("L1C_WT"); // 0|1 for back|through
-	    l1c.write_allocate = (bool)cfg.GetConfig("L1C_WA"); // 0|1 for no-alc|alc
-	    l1cache->SetConfig(l1c);
-    	l1cache->SetPrefetch(cfg.GetConfig("L1C_PREFETCH"));
-	    l1cache->Allocate();
-	    if (cacheLevel > 1)
-    		l1cache->SetLower(l2cache);
-    	else
-    		l1cache->SetLower(mainMem);
+        caches[i] = NewCache(cfg, layout[i], tagOnly);
+        if (layout[i].lower < 0)
+        {
+            caches[i]->SetLower(mainMem);
+            continue;
+        }
+        Cache *lower = caches[layout[i].lower];
+        caches[i]->SetLower(lower);
+        lower->AddUpper(caches[i]);
+        // invalidations and victims move whole lines of the upper level
+        if (lower->Inclusion() != NON_INCLUSIVE && caches[i]->LineSize() > lower->LineSize())
+            panic("[Error] %s lines are larger than the %s lines below. [StorageInit]\n",
+                  layout[i].label.c_str(), inclusion_str[lower->Inclusion()]);
+        caches[i]->SetVictimFill(lower->Inclusion() == EXCLUSIVE && caches[i]->LineSize() == lower->LineSize());
     }
 
-	if (cacheLevel != 0)
-    	topStorage = l1cache;
-    else
-    	topStorage = mainMem;
+    topStorage = data >= 0 ? (Storage*)caches[data] : mainMem;
+    instStorage = inst >= 0 ? (Storage*)caches[inst] : mainMem;
+    if (data >= 0 && caches[data]->NonBlocking())
+        loadHitCyc = caches[data]->HitLatency() > 1 ? caches[data]->HitLatency() : 1;
 }
 
+// Sum of the cache sizes and the distinct bytes the caches hold now,
+// a line held at several levels counts once
 void
-Machine::Run()
+Machine::PrintCapacity(FILE *fout)
 {
-	Timer timer;
+	if (fout == NULL)
+		fout = stdout;
 
-	runTime = 0;
-	F_reg.bubble = false;
+	uint64_t total = 0;
+	int grain = 0;
+	for (size_t i = 0; i < caches.size(); ++i)
+	{
+		CacheConfig cc;
+		caches[i]->GetConfig(cc);
+		total += cc.size + caches[i]->VictimLines() * cc.line_size;
+		if (grain == 0 || cc.line_size < grain)
+			grain = cc.line_size;
+	}
 
-	if(singleStep)
-		SingleStepInfo();
-    for ( ; ; )
-    {
-    	int mxCyc = 1, useCyc;
-    	timer.StepTime();
-		if ((useCyc = Fetch()) == 0)
-		{
-			panic("Fetch error!\n");
-		}
-		else
-		{
-			vprintf("- Fetch CPU Cyc: %d\n", useCyc);
-			mxCyc = MAX(mxCyc, useCyc);
-		}
+	std::unordered_set<uint64_t> held;
+	std::vector<uint64_t> lines;
+	for (size_t i = 0; i < caches.size(); ++i)
+	{
+		lines.clear();
+		caches[i]->ValidLines(lines);
+		for (size_t k = 0; k < lines.size(); ++k)
+			for (int off = 0; off < caches[i]->LineSize(); off += grain)
+				held.insert((lines[k] + off) / grain);
+	}
+	fprintf(fout, "- Cache Capacity:    %llu   (EFFECTIVE:%llu)\n", (unsigned long long)total,
+			(unsigned long long)held.size() * grain);
+}
 
-		if ((useCyc = Decode()) == 0)
-		{
-			panic("Decode error!\n");
-		}
-		else
-		{
-			vprintf("- Decode CPU Cyc: %d\n", useCyc);
-			mxCyc = MAX(mxCyc, useCyc);
-		}
+// One pipeline cycle, false once the program has exited
+bool
+Machine::Cycle()
+{
+	int mxCyc = 1, useCyc;
 
-		if ((useCyc = Execute()) == 0)
-		{
-			panic("Execute error!\n");
-		}
-		else
-		{
-			vprintf("- Execute CPU Cyc: %d\n", useCyc);
-			mxCyc = MAX(mxCyc, useCyc);
-		}
+	if ((useCyc = Fetch()) == 0)
+	{
+		panic("Fetch error!\n");
+	}
+	else
+	{
+		vprintf("- Fetch CPU Cyc: %d\n", useCyc);
+		mxCyc = MAX(mxCyc, useCyc);
+	}
 
-		if ((useCyc = MemoryAccess()) == 0)
-		{
-			panic("Memory error!\n");
-		}
-		else
-		{
-			vprintf("- Memory CPU Cyc: %d\n", useCyc);
-			mxCyc = MAX(mxCyc, useCyc);
-		}
+	if ((useCyc = Decode()) == 0)
+	{
+		panic("Decode error!\n");
+	}
+	else
+	{
+		vprintf("- Decode CPU Cyc: %d\n", useCyc);
+		mxCyc = MAX(mxCyc, useCyc);
+	}
 
-		if ((useCyc = WriteBack()) == 0)
-		{
-			panic("WriteBack error!\n");
-		}
-		else
-		{
-			vprintf("- WriteBack CPU Cyc: %d\n", useCyc);
-			mxCyc = MAX(mxCyc, useCyc);
-		}
+	if ((useCyc = Execute()) == 0)
+	{
+		panic("Execute error!\n");
+	}
+	else
+	{
+		vprintf("- Execute CPU Cyc: %d\n", useCyc);
+		mxCyc = MAX(mxCyc, useCyc);
+	}
+
+	if ((useCyc = MemoryAccess()) == 0)
+	{
+		panic("Memory error!\n");
+	}
+	else
+	{
+		vprintf("- Memory CPU Cyc: %d\n", useCyc);
+		mxCyc = MAX(mxCyc, useCyc);
+	}
+
+	if ((useCyc = WriteBack()) == 0)
+	{
+		panic("WriteBack error!\n");
+	}
+	else
+	{
+		vprintf("- WriteBack CPU Cyc: %d\n", useCyc);
+		mxCyc = MAX(mxCyc, useCyc);
+	}
+	if (halted)
+		return false;
+
+	UpdatePipeline();
+
+	cycCount++;
+	cpuCount += mxCyc;
+	return true;
+}
 
-		UpdatePipeline();
+// Cycle-level run, stops after maxInst committed insts if non-zero
+void
+Machine::Run(uint64_t maxInst)
+{
+	Timer timer;
 
-		cycCount++;
-		cpuCount += mxCyc;
+	// nothing in flight (fresh or drained machine): start fetching
+	if (D_reg.bubble && E_reg.bubble && M_reg.bubble && W_reg.bubble)
+		F_reg.bubble = false;
+
+	if(singleStep)
+		SingleStepInfo();
+    while (!halted)
+    {
+    	timer.StepTime();
+    	if (!Cycle())
+    		break;
 		runTime += timer.StepTime();
 
+		if (CheckpointDue())
+			TakeCheckpoint();
+
 		if (debug)
 		{
 			PrintReg();
@@ -261,9 +348,22 @@ Machine::Run()
 
     	if (singleStep)
     		SingleStepDebug();
+
+    	if (maxInst && (uint64_t)instCount >= maxInst)
+    		break;
     }
+}
 
-    Status();
+// Stop fetching and let in-flight insts commit, P_PCReg then holds the
+// next inst in program order
+void
+Machine::Drain()
+{
+	draining = true;
+	while (!halted && !(D_reg.bubble && E_reg.bubble && M_reg.bubble && W_reg.bubble))
+		Cycle();
+	draining = false;
+	WriteReg(P_PCReg, commitNext);
 }
 
 void
@@ -276,6 +376,8 @@ Machine::Status(FILE *fout)
 	}
 	fprintf(fout, "\n---------------- Machine ---------------\n");
 	fprintf(fout, "BASIC STATUS: \n");
+	if (ffCount)
+		fprintf(fout, "- Fast-forwarded:    %llu\n", ffCount);
 	fprintf(fout, "- Cycle Count:       %d\n", cycCount);
 	fprintf(fout, "- Inst. Count:       %d\n", instCount);
 	fprintf(fout, "- Run Time:          %.4lf\n", runTime);
@@ -289,6 +391,8 @@ Machine::Status(FILE *fout)
 	fprintf(fout, "- Ctrl. Hazard:      %d * 2\t(cycles)\n", ctrlHzdCount);
 	fprintf(fout, "- ECALL Stall:       %d * 3\t(cycles)\n", ecallStlCount);
 	fprintf(fout, "- JALR Stall:        %d * 2\t(cycles)\n", jalrStlCount);
+	if (loadHitCyc)
+		fprintf(fout, "- Load Miss Stall:   %d\t(CPU cycles)\n", memStlCount);
 	
 	fprintf(fout, "\nREGISTER FILE: \n");
 	fprintf(fout, "- Reg. Num           %d\n", RegNum);
@@ -298,32 +402,19 @@ Machine::Status(FILE *fout)
 	// cfg.Print(fout);
 
 	fprintf(fout, "\n----------------- Cache ----------------\n");
-	fprintf(fout, "L1 Cache: \n");
-	if (l1cache)
-	{
-		l1cache->Print(fout);
-	}
-	else
-	{
-		fprintf(fout, "  None\n");
-	}
-	fprintf(fout, "\nL2 Cache: \n");
-	if (l2cache)
+	for (size_t i = 0; i < caches.size(); ++i)
 	{
-		l2cache->Print(fout);
+		fprintf(fout, "%s%s Cache: \n", i ? "\n" : "", layout[i].label.c_str());
+		caches[i]->Print(fout);
 	}
-	else
+	if (caches.empty())
 	{
 		fprintf(fout, "  None\n");
 	}
-	fprintf(fout, "\nL3 Cache: \n");
-	if (l3cache)
-	{
-		l3cache->Print(fout);
-	}
 	else
 	{
-		fprintf(fout, "  None\n");
+		fprintf(fout, "\n");
+		PrintCapacity(fout);
 	}
 	fprintf(fout,   "----------------------------------------\n");
 
@@ -6,25 +6,36 @@
 #include "riscsim.hpp"
 #include "predictor.hpp"
 #include "config.hpp"
+#include "trace.hpp"
 #include <map>
 #include <queue>
 #include <string>
+#include <vector>
 
 #define ZeroReg             0
 #define SPReg               2
 #define A0Reg               10
 #define A1Reg               11
+#define A4Reg               14
 #define A7Reg               17
 #define PCReg               32
 #define P_PCReg             33  // predict pc
 
 #define RegNum              36
 #define PageSize            4096
-#define PhysicalPageNum     20000
-#define PhysicalMemSize     PhysicalPageNum * PageSize
+#define PhysicalPageNum     20000   // default, see physPages
 
 #define StackTopPtr         0x80000000
-#define StackPageNum        4
+#define StackPageNum        4           // mapped at load time
+#define StackMaxPages       2048        // grows on demand up to 8 MB
+#define MmapTopPtr          (StackTopPtr - StackMaxPages * PageSize)
+
+// Linux syscall numbers
+#define SysMunmap           215
+#define SysBrk              214
+#define SysMmap             222
+#define SysENOMEM           12
+#define SysEINVAL           22
 
 class PipelineRegister
 {
@@ -32,6 +43,7 @@ public:
     Instruction inst;
     bool bubble, stall, pred_j;
     int64_t val_e, val_c; // in decode stage - val_e=reg_a  val_c=reg_b
+    uint32_t seq;         // fetch order, for the event trace
 
     PipelineRegister()
     {
@@ -53,9 +65,15 @@ public:
 
     // memory operation
     bool AllocatePage(uint64_t vpn);
-    int ReadMem(uint64_t addr, int size, void *value);
-    int WriteMem(uint64_t addr, int size, uint64_t value, bool MemDirect = false);
+    bool DemandPage(uint64_t vpn);
+    bool LoadSegment(uint64_t adr, const uint8_t *data, uint64_t fileSize, uint64_t memSize);
+    uint64_t Brk(uint64_t addr);
+    uint64_t Mmap(uint64_t len);
+    uint64_t Munmap(uint64_t addr, uint64_t len);
+    int ReadMem(uint64_t addr, int size, void *value, MemAccess type = AccessLoad, uint64_t pc = 0);
+    int WriteMem(uint64_t addr, int size, uint64_t value, bool MemDirect = false, uint64_t pc = 0);
     bool Translate(uint64_t v_addr, uint64_t *p_addr, int size);
+    void TlbFlush();
     void PrintMem(FILE *fout = NULL, bool no_data = false);
     void PrintPageTable(FILE *fout = NULL);
 
@@ -66,30 +84,80 @@ public:
     int MemoryAccess();
     int WriteBack();
     void UpdatePipeline();
+    void Trace(const PipelineRegister &r, int kind, int stage, int arg = 0)
+    {
+        if (trace)
+            trace->Record(cycCount, r.seq, r.inst.adr, r.inst.value, kind, stage, arg);
+    }
+    bool Syscall(bool memDirect = false);
+
+    // functional execution (fast-forward)
+    int FuncMem(uint64_t addr, int size, int read, uint64_t *value, bool warm, MemAccess type = AccessLoad);
+    bool FuncStep(bool warm);
+    void FastForward(uint64_t num, bool warm);
+    void SyncCaches();
+    void FlushCaches();
+    void ResetStats();
+
+    // checkpoint
+    bool WriteState(FILE *f);
+    bool ReadState(FILE *f);
+    bool SaveCheckpoint(const char *name);
+    bool LoadCheckpoint(const char *name);
+    bool CheckpointDue();
+    void TakeCheckpoint();
 
     // machine
-    void StorageInit(int cacheLevel);
-    void Run();
+    void StorageInit(int cacheLevel, bool tagOnly = false);
+    bool Cycle();
+    void Run(uint64_t maxInst = 0);
+    void Drain();
     void Status(FILE *fout = NULL);
+    void PrintCapacity(FILE *fout = NULL);
     void SingleStepDebug();
 
     int64_t reg[RegNum];
 
     Memory *mainMem;
-    Cache *l1cache, *l2cache, *l3cache;
-    Storage *topStorage;
+    std::vector<CacheNode> layout;
+    std::vector<Cache*> caches;     // as layout, top-down
+    Storage *topStorage;            // loads and stores, trace accesses
+    Storage *instStorage;           // instruction fetch
 
     std::map<uint64_t, PageTableEntry*> pageTable;
-    PageTableEntry *pte;
-    std::priority_queue<uint64_t> freePage;
+    PageTableEntry *pte;    // indexed by ppn
+    uint64_t physPages;
+    TlbEntry tlb[TlbSize];
+    PageAllocator freePage;
+    uint64_t brkBase, brkPtr;   // heap [brkBase, brkPtr), pages on demand
+    uint64_t mmapPtr;           // lowest anonymous mapping, grows down
     PipelineRegister F_reg, D_reg, E_reg, M_reg, W_reg;
     PipelineRegister f_reg, d_reg, e_reg, m_reg;
+    Instruction *decodeCache; // indexed by pc, see DecodeCacheSize
 
     Predictor *predictor;
+    TraceRecorder *trace;   // pipeline event trace, NULL if off
 
     Config cfg;
 
     bool singleStep;
+    bool halted;
+    bool draining;          // fetch stopped, see Drain()
+    uint64_t commitNext;    // pc after the last committed inst
+    uint32_t fetchSeq;      // last fetch sequence number
+    bool fetchRetry;        // fetch was stalled, same inst comes again
+    bool quiet;             // drop guest output, several machines share stdout
+
+    // per-cycle pipeline state shared between stages
+    bool predict_pc_updated;
+    uint64_t f_pred_pc;
+    bool data_forwarded_rs1;
+    bool data_forwarded_rs2;
+    uint64_t ffCount;
+
+    uint64_t ckptAt;        // checkpoint at this inst count, 0 for never
+    bool ckptPending;       // requested by the guest
+    std::string ckptName;
     int cycCount;
     int cpuCount;
     int instCount;
@@ -100,6 +168,12 @@ public:
     int totalBranch;
     int ecallStlCount;
     int jalrStlCount;
+
+    // non-blocking data cache: a load miss leaves M after loadHitCyc and
+    // the first inst using its rd waits in E until the data arrives
+    int loadHitCyc;         // 0: blocking, the load holds M for the whole miss
+    int regReady[RegNum];   // cpuCount the load in flight writes the reg
+    int memStlCount;        // cycles waited in E for loads in flight
 };
 
 #endif
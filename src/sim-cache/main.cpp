@@ -1,12 +1,15 @@
 #include "machine.hpp"
+#include "sampler.hpp"
+#include "mrc.hpp"
+#include "image.hpp"
+#include "sweep.hpp"
 #include "utils.hpp"
 
-#include <elfio/elfio.hpp>
-
 #include <string.h>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <thread>
 using namespace std;
 
 #include <boost/program_options.hpp>
@@ -17,7 +20,18 @@ bool singleStep = false;
 string fileName, cfgName;
 PRED_TYPE predType;
 bool runTrace = false;
+bool mrc = false;
 int cacheLevel = 3;
+uint64_t ffInst = 0, detailInst = 0;
+bool warmUp = false;
+uint64_t samplePeriod = 0, sampleSize = 1000, sampleWarmup = 2000;
+uint64_t ckptAt = 0;
+string ckptName, restoreName;
+string traceName;
+uint64_t memPages = PhysicalPageNum;
+vector<string> sweepSpecs;
+string sweepOut = "sweep.csv";
+int sweepJobs = 0;
 
 void ParseArg(int argc, char *argv[])
 {
@@ -26,14 +40,30 @@ void ParseArg(int argc, char *argv[])
     opts.add_options()
         (",s", "single step")
         (",t", "running a trace")
+        ("mrc", "with -t: LRU miss ratios of all cache sizes in one pass")
         ("verbose,v", "print more info")
         ("debug,d", "print debug info")
         ("config,c", value<string>()->required(), "set config file (format as 'config/default.cfg')")
         ("filename,f", value<string>()->required(), "riscv elf file")
-        ("level,l", value<int>()->required(), "cache level (can be 0-3)")
+        ("level,l", value<int>()->required(), "cache level (can be 0-3), ignored with C1_* keys in the cfg")
         ("pred,p", value<int>()->required(),
          "branch predict strategy (0-4)\n 0: always not taken\n 1: always taken\n 2: 1-bit predictor\n \
 3: 2-bit predictor\n 4: 2-bit predictor alternative")
+        ("fast-forward", value<uint64_t>(), "run the first N insts functionally")
+        ("detail", value<uint64_t>(), "stop after M insts in the pipeline")
+        ("warm", "warm caches and predictor while fast-forwarding")
+        ("sample-period", value<uint64_t>(), "sample once every P insts")
+        ("sample-size", value<uint64_t>(), "measured insts per sample (default 1000)")
+        ("sample-warmup", value<uint64_t>(), "detailed warm-up insts per sample (default 2000)")
+        ("checkpoint-at", value<uint64_t>(), "write a checkpoint after N insts")
+        ("checkpoint-file", value<string>(), "checkpoint file name (default 'machine.ckpt')")
+        ("restore", value<string>(), "start from a checkpoint instead of an elf file")
+        ("trace", value<string>(), "record pipeline events to a binary trace file")
+        ("mem-size", value<uint64_t>(), "physical memory size in MB (default 20000 pages)")
+        ("sweep", value<vector<string> >()->composing(),
+         "NAME=v1,v2,... run every combination of the given cfg keys or PRED, may repeat")
+        ("sweep-out", value<string>(), "sweep result table, JSON if it ends in .json (default 'sweep.csv')")
+        ("jobs,j", value<int>(), "sweep threads (default: all cores)")
         ("help,h", "print help info")
         ;
     variables_map vm;
@@ -57,6 +87,11 @@ void ParseArg(int argc, char *argv[])
         runTrace = true;
     }
 
+    if (vm.count("mrc"))
+    {
+        mrc = true;
+    }
+
     if(vm.count("debug"))
     {
         debug = true;
@@ -76,12 +111,51 @@ void ParseArg(int argc, char *argv[])
         verbose = true;
     }    
 
+    if (vm.count("checkpoint-at"))
+    {
+        ckptAt = vm["checkpoint-at"].as<uint64_t>();
+    }
+
+    if (vm.count("checkpoint-file"))
+    {
+        ckptName = vm["checkpoint-file"].as<string>();
+    }
+
+    if (vm.count("restore"))
+    {
+        restoreName = vm["restore"].as<string>();
+    }
+
+    if (vm.count("trace"))
+    {
+        traceName = vm["trace"].as<string>();
+    }
+
+    if (vm.count("mem-size"))
+    {
+        memPages = vm["mem-size"].as<uint64_t>() * 1024 * 1024 / PageSize;
+        if (memPages == 0 || memPages > (1ull << 32))
+        {
+            printf("memory size must be between 1 MB and 16 TB.\n");
+            exit(0);
+        }
+    }
+
+    if (vm.count("sweep"))
+    {
+        sweepSpecs = vm["sweep"].as<vector<string> >();
+        if (vm.count("sweep-out"))
+            sweepOut = vm["sweep-out"].as<string>();
+        if (vm.count("jobs"))
+            sweepJobs = vm["jobs"].as<int>();
+    }
+
     //--filename tmp.txt
     if (vm.count("filename"))
     {
         fileName = vm["filename"].as<string>();
     }
-    else
+    else if (restoreName.empty())
     {
         printf("please use -f to specify the risc-v file.\n");
         exit(0);
@@ -115,62 +189,61 @@ void ParseArg(int argc, char *argv[])
     else
         predType = ALWAYS_NTAKEN;
 
+    if (vm.count("fast-forward"))
+    {
+        ffInst = vm["fast-forward"].as<uint64_t>();
+    }
+
+    if (vm.count("detail"))
+    {
+        detailInst = vm["detail"].as<uint64_t>();
+    }
+
+    if (vm.count("warm"))
+    {
+        warmUp = true;
+    }
+
+    if (vm.count("sample-period"))
+    {
+        samplePeriod = vm["sample-period"].as<uint64_t>();
+        if (vm.count("sample-size"))
+            sampleSize = vm["sample-size"].as<uint64_t>();
+        if (vm.count("sample-warmup"))
+            sampleWarmup = vm["sample-warmup"].as<uint64_t>();
+        if (sampleSize == 0 || samplePeriod < sampleSize + sampleWarmup)
+        {
+            printf("sample period must cover warm-up and a non-empty sample.\n");
+            exit(0);
+        }
+    }
+
     printf("[verbose]  %s\n", verbose?"on":"off");
     printf("[debug]    %s\n", debug?"on":"off");
-    printf("[single]   %s\n\n", singleStep?"on":"off");
+    printf("[single]   %s\n", singleStep?"on":"off");
+    if (ffInst || detailInst)
+        printf("[detail]   ffwd %llu, detail %llu%s\n", ffInst, detailInst, warmUp?", warm":"");
+    if (samplePeriod)
+        printf("[sample]   period %llu, size %llu, warm-up %llu\n", samplePeriod, sampleSize, sampleWarmup);
+    printf("\n");
 }
 
 void LoadELF()
 {
-    ELFIO::elfio elf;
+    ElfImage image;
     Timer timer;
     vprintf("***** loading elf file\n");
-    elf.load(fileName.c_str());
-
-    if (elf.get_machine() != EM_RISCV)
+    if (!image.Load(fileName.c_str()))
     {
         printf("not a risc-v prog.\n");
         return;
     }
 
     vprintf("loading data to memory...\n");
-    ELFIO::Elf_Half n_seg = elf.segments.size();
-
-    for (int i = 0; i < n_seg; ++i)
-    {
-        const ELFIO::segment *pseg = elf.segments[i];
-
-        uint64_t adr = pseg->get_virtual_address();
-        uint64_t m_end = adr + pseg->get_memory_size();
-        uint64_t f_end = adr + pseg->get_file_size();
-        // add page table entry
-        for (uint64_t vpn = (adr/PageSize); vpn*PageSize < f_end; vpn++)
-        {
-            machine->AllocatePage(vpn);            
-        }
-
-        const uint8_t* data = (uint8_t*)pseg->get_data();
-        for (uint64_t offset = 0; adr < m_end; adr++, offset++)
-        {
-            machine->WriteMem(adr, 1, data[offset], true);
-        }
-
-    }
-
-    // pipeline - predict pc
-    machine->WriteReg(P_PCReg, elf.get_entry());
-    // machine->PrintReg();
-
-    vprintf("initializing stack...\n");
-    // stack initialization
-    machine->WriteReg(SPReg, StackTopPtr - 8);
+    if (!image.Apply(machine))
     {
-        uint64_t vpn = (StackTopPtr / PageSize) - 1;
-        for (int i = 0; i < StackPageNum; i++, vpn--)
-        {
-            machine->AllocatePage(vpn);
-        }
-        machine->WriteMem(StackTopPtr - 8, 8, 0xdeadbeefdeadbeefll, true);
+        printf("can not load %s.\n", fileName.c_str());
+        exit(0);
     }
     vprintf("***** loading elf end [%.2lf]\n\n", timer.Finish());
 }
@@ -184,11 +257,18 @@ void RunTrace()
         exit(0);
     }
 
+    // caches are tag-only, no data travels with the requests
     int hit, time;
     int64_t tot_time = 0;
-    uint8_t content[64];
-    content[0] = 1;
-    
+    unsigned line = machine->cfg.GetConfig("L1C_BSIZE");
+    if (machine->topStorage != machine->mainMem)
+    {
+        CacheConfig cc;
+        ((Cache*)machine->topStorage)->GetConfig(cc);
+        line = cc.line_size;
+    }
+    MissRatioCurve *curve = mrc ? new MissRatioCurve(line) : NULL;
+
     char buf[100];
     int cnt = 0;
     while(fgets(buf, 100, trace))
@@ -198,13 +278,24 @@ void RunTrace()
         sscanf(buf, "%s %llx", op, &addr);
         // addr %= PhysicalMemSize;
         vprintf("%s 0x%llx\n", op, addr);
+        if (curve)
+        {
+            if (op[0] != 'r' && op[0] != 'w')
+            {
+                printf("unknown command.\n");
+                exit(0);
+            }
+            curve->Access(addr);
+            cnt++;
+            continue;
+        }
         switch (op[0])
         {
             case 'r':
-                machine->topStorage->HandleRequest(addr, 1, 1, content, hit, time);
+                machine->topStorage->HandleRequest(MakeRequest(addr, 1, 1, AccessLoad, 0, tot_time), NULL, hit, time);
                 break;
             case 'w':
-                machine->topStorage->HandleRequest(addr, 1, 0, content, hit, time);
+                machine->topStorage->HandleRequest(MakeRequest(addr, 1, 0, AccessStore, 0, tot_time), NULL, hit, time);
                 break;
             default:
                 printf("unknown command.\n");
@@ -217,27 +308,64 @@ void RunTrace()
 
     // printf("%lld ", tot_time);
 
+    if (curve)
+    {
+        curve->Print();
+        delete curve;
+        fclose(trace);
+        return;
+    }
+
     // double l1m = machine->l1cache->MissRate();
     // double l2m = machine->l2cache->MissRate();
     // printf("L1 Cache: %lf\n", l1m);
     // printf("L2 Cache: %lf\n", l2m);
     // printf("AMAT: %lf\n", (1-l1m) + l1m*(1-l2m)*8 + l1m*l2m*100);
-    if(cacheLevel > 0)
+    for (size_t i = 0; i < machine->caches.size(); ++i)
     {
-        printf("L1 Cache:\n");
-        machine->l1cache->Print();
+        printf("%s Cache:\n", machine->layout[i].label.c_str());
+        machine->caches[i]->Print();
     }
-    if(cacheLevel > 1)
+    if (!machine->caches.empty())
+        machine->PrintCapacity();
+    fclose(trace);
+}
+
+// Every configuration in its own machine on a thread pool, the trace or
+// ELF is read once
+void RunSweep()
+{
+    Config base;
+    base.LoadConfig(cfgName.c_str());
+    Sweep sweep(base, cacheLevel, predType);
+    sweep.ffInst = ffInst;
+    sweep.detailInst = detailInst;
+    sweep.warm = warmUp;
+    sweep.memPages = memPages;
+
+    for (size_t i = 0; i < sweepSpecs.size(); ++i)
+        if (!sweep.AddParam(sweepSpecs[i].c_str()))
+        {
+            printf("bad sweep parameter '%s'.\n", sweepSpecs[i].c_str());
+            exit(0);
+        }
+
+    if (runTrace ? !sweep.LoadTrace(fileName.c_str()) : !sweep.LoadElf(fileName.c_str()))
     {
-        printf("L2 Cache:\n");
-        machine->l2cache->Print();
+        printf("can not load %s.\n", fileName.c_str());
+        exit(0);
     }
-    if(cacheLevel > 2)
+
+    int jobs = sweepJobs > 0 ? sweepJobs : thread::hardware_concurrency();
+    Timer timer;
+    sweep.Run(jobs);
+    double t = timer.Finish();
+    if (!sweep.Write(sweepOut.c_str()))
     {
-        printf("L3 Cache:\n");
-        machine->l3cache->Print();
+        printf("can not write %s.\n", sweepOut.c_str());
+        exit(0);
     }
-    fclose(trace);
+    printf("sweep: %d threads, %.2lf s, results in %s.\n", jobs, t, sweepOut.c_str());
 }
 
 void Test()
@@ -245,7 +373,7 @@ void Test()
     Memory *mainMem;
     Cache *l1cache, *l2cache, *l3cache;
 
-    mainMem = new Memory();
+    mainMem = new Memory((uint64_t)PhysicalPageNum * PageSize);
     l1cache = new Cache("L1 cache");
     l2cache = new Cache("L2 cache");
     l3cache = new Cache("L3 cache");
@@ -307,16 +435,16 @@ void Test()
     int hit, time, tot_time = 0;
     uint8_t content[64];
     content[0] = 0x01;
-    l1cache->HandleRequest(0x4e1f0b0, 1, 0, content, hit, time);
+    l1cache->HandleRequest(MakeRequest(0x4e1f0b0, 1, 0, AccessStore), content, hit, time);
     content[0] = 0x23;
-    l1cache->HandleRequest(0x4e1f0b1, 1, 0, content, hit, time);
+    l1cache->HandleRequest(MakeRequest(0x4e1f0b1, 1, 0, AccessStore), content, hit, time);
     content[0] = 0x45;
-    l1cache->HandleRequest(0x4e1f0b2, 1, 0, content, hit, time);
+    l1cache->HandleRequest(MakeRequest(0x4e1f0b2, 1, 0, AccessStore), content, hit, time);
     content[0] = 0x67;
-    l1cache->HandleRequest(0x4e1f0b3, 1, 0, content, hit, time);
+    l1cache->HandleRequest(MakeRequest(0x4e1f0b3, 1, 0, AccessStore), content, hit, time);
     content[0] = 0x67;
-    l1cache->HandleRequest(0x3e1f0b0, 1, 0, content, hit, time);
-    l1cache->HandleRequest(0x4e1f0b0, 4, 1, content, hit, time);
+    l1cache->HandleRequest(MakeRequest(0x3e1f0b0, 1, 0, AccessStore), content, hit, time);
+    l1cache->HandleRequest(MakeRequest(0x4e1f0b0, 4, 1, AccessLoad), content, hit, time);
 
     for(int i = 0; i < 4; ++i)
     {
@@ -330,11 +458,18 @@ int main(int argc, char *argv[])
     // parse args
     ParseArg(argc, argv);
 
+    if (!sweepSpecs.empty())
+    {
+        RunSweep();
+        return 0;
+    }
+
     // build machine
     machine = new Machine(predType);
     machine->singleStep = singleStep;
     machine->cfg.LoadConfig(cfgName.c_str());
-    machine->StorageInit(cacheLevel);
+    machine->physPages = memPages;
+    machine->StorageInit(cacheLevel, runTrace);
     // for (int i = 0; i <= 10; i += 2)
     // {  
     //     for (int j = 0; j < 10; j++)
@@ -380,10 +515,54 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    LoadELF();
+    machine->ckptAt = ckptAt;
+    if (!ckptName.empty())
+        machine->ckptName = ckptName;
+
+    if (!restoreName.empty())
+    {
+        if (!machine->LoadCheckpoint(restoreName.c_str()))
+        {
+            printf("can not restore checkpoint %s.\n", restoreName.c_str());
+            exit(0);
+        }
+        printf("restored '%s' at inst %llu.\n", restoreName.c_str(), machine->ffCount + machine->instCount);
+    }
+    else
+        LoadELF();
+
+    // functional warm-up, then the detailed window
+    if (ffInst)
+    {
+        machine->FastForward(ffInst, warmUp);
+        machine->ResetStats();
+    }
+
+    if (!traceName.empty())
+    {
+        machine->trace = new TraceRecorder();
+        if (!machine->trace->Open(traceName.c_str()))
+        {
+            printf("can not open trace file %s.\n", traceName.c_str());
+            exit(0);
+        }
+    }
 
     // machine run
-    machine->Run();
+    if (samplePeriod)
+    {
+        Sampler sampler(machine, samplePeriod, sampleSize, sampleWarmup);
+        sampler.Run();
+        sampler.Print();
+    }
+    else
+        machine->Run(detailInst);
+    if (machine->trace)
+    {
+        machine->trace->Close();
+        printf("trace: %llu records in %s.\n", machine->trace->records, traceName.c_str());
+    }
+    machine->Status();
 
     return 0;
 }
@@ -2,31 +2,46 @@
 #include "utils.hpp"
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 
-Memory::Memory()
+Memory::Memory(uint64_t size)
+: size(size)
 {
-	data = new uint8_t[PhysicalMemSize];
-	memset(data, 0, sizeof data);
+	// only reserved here, the host maps zero pages as they are touched
+	data = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+						  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (data == MAP_FAILED)
+		panic("[Error] Can not reserve %llu bytes of memory. [Memory]\n", size);
 }
 
 Memory::~Memory()
 {
-	delete [] data;
+	munmap(data, size);
 }
 
 void
-Memory::HandleRequest(uint64_t addr, int bytes, int read,
-					uint8_t *content, int &hit, int &time,
-					bool prefetching)
+Memory::HandleRequest(const MemRequest &req,
+					uint8_t *content, int &hit, int &time)
 {
+	uint64_t addr = req.addr;
+	int bytes = req.bytes;
+
 	// dprintf("memory: requested on 0x%llx, %d bytes, read: %d\n", addr, bytes, read);
 	hit = 1;
 	time = latency_.hit_latency + latency_.bus_latency;
 	stats_.access_time += time;
 
-	if (read) // read
+	if (content == NULL) // from a tag-only cache
+		return;
+	if (req.type == AccessPrefetch && addr + bytes > size) // prefetched past the end
 	{
-		if (addr + bytes <= PhysicalMemSize)
+		memset(content, 0, bytes);
+		return;
+	}
+
+	if (req.read) // read
+	{
+		if (addr + bytes <= size)
 		{
 			memcpy(content, data+addr, bytes);
 		}
@@ -38,7 +53,7 @@ Memory::HandleRequest(uint64_t addr, int bytes, int read,
 	}
 	else // write
 	{
-		if (addr + bytes <= PhysicalMemSize)
+		if (addr + bytes <= size)
 		{
 			memcpy(data+addr, content, bytes);
 		}
@@ -50,31 +65,141 @@ Memory::HandleRequest(uint64_t addr, int bytes, int read,
 	}
 }
 
+// Allocation continues below the lowest page of a restored page table
+void
+PageAllocator::Restore(const std::vector<bool> &used)
+{
+	Reset(used.size());
+	for (uint64_t i = 0; i < total; ++i)
+		if (used[i])
+		{
+			next = i;
+			break;
+		}
+}
+
 bool
 Machine::AllocatePage(uint64_t vpn)
 {
 	// virutal memory - TODO
-	if (freePage.empty())
+	if (freePage.Empty())
 	{
 		vprintf("[Error] Run out of memory. [AllocatePage]\n");
 		return false;
 	}
 
-	uint64_t ppn = freePage.top();
-	freePage.pop();
+	uint64_t ppn = freePage.Allocate();
 
 	pte[ppn].valid = true;
 	pte[ppn].ppn = ppn;
 	pte[ppn].vpn = vpn;
 	pageTable[vpn] = (pte+ppn);
+	tlb[vpn & (TlbSize - 1)].vpn = ~0ull; // mapping may have changed
 
 	dprintf("Allocated physical page 0x%08llx for vp 0x%08llx.\n", ppn, vpn);
 
 	return true;
 }
 
+// First touch of an unmapped page: map it if it lies in the stack, the
+// heap below the break or an anonymous mapping. Physical pages are never
+// reused, so a fresh one is always zero and not cached anywhere.
+bool
+Machine::DemandPage(uint64_t vpn)
+{
+	uint64_t addr = vpn * PageSize;
+	bool stack = addr < StackTopPtr && addr >= StackTopPtr - StackMaxPages * PageSize;
+	bool heap = addr >= brkBase && addr < brkPtr;
+	bool anon = addr >= mmapPtr && addr < MmapTopPtr;
+
+	if (!stack && !heap && !anon)
+		return false;
+	dprintf("Demand paging on vp 0x%08llx.\n", vpn);
+	return AllocatePage(vpn);
+}
+
+// Map [adr, adr+memSize) and copy the file part page by page straight
+// into physical memory. Fresh pages are already zero, so the BSS tail
+// only needs clearing on a page an earlier segment mapped.
+bool
+Machine::LoadSegment(uint64_t adr, const uint8_t *data, uint64_t fileSize, uint64_t memSize)
+{
+	uint64_t start = adr, end = adr + memSize, fileEnd = adr + fileSize;
+	while (adr < end)
+	{
+		uint64_t vpn = adr / PageSize, offset = adr % PageSize;
+		uint64_t chunk = PageSize - offset;
+		if (chunk > end - adr)
+			chunk = end - adr;
+
+		bool fresh = pageTable.find(vpn) == pageTable.end();
+		if (fresh && !AllocatePage(vpn))
+			return false;
+		uint8_t *host = mainMem->Raw(pageTable[vpn]->ppn * PageSize) + offset;
+
+		uint64_t copy = adr < fileEnd ? fileEnd - adr : 0;
+		if (copy > chunk)
+			copy = chunk;
+		if (copy)
+			memcpy(host, data + (adr - start), copy);
+		if (!fresh && copy < chunk)
+			memset(host + copy, 0, chunk - copy);
+		adr += chunk;
+	}
+	return true;
+}
+
+// Program break, addr 0 queries it; a failed request leaves it unchanged.
+// Shrinking keeps the pages mapped.
+uint64_t
+Machine::Brk(uint64_t addr)
+{
+	if (addr >= brkBase && addr < mmapPtr)
+		brkPtr = addr;
+	return brkPtr;
+}
+
+// Anonymous mapping of len bytes below the previous one, pages on demand
+uint64_t
+Machine::Mmap(uint64_t len)
+{
+	uint64_t size = (len + PageSize - 1) / PageSize * PageSize;
+	if (len == 0 || size > mmapPtr - brkPtr)
+		return -SysENOMEM;
+	mmapPtr -= size;
+	return mmapPtr;
+}
+
+// Only unmapping the lowest mapping gives its range back to Mmap, other
+// ranges stay in use. Its pages stay mapped but are cleared and dropped
+// from every cache, so they read as zero when mapped again.
+uint64_t
+Machine::Munmap(uint64_t addr, uint64_t len)
+{
+	uint64_t size = (len + PageSize - 1) / PageSize * PageSize;
+	if (len == 0 || addr % PageSize)
+		return -SysEINVAL;
+	if (addr != mmapPtr || size > MmapTopPtr - addr)
+		return 0;
+
+	for (uint64_t adr = addr; adr < addr + size; adr += PageSize)
+	{
+		std::map<uint64_t, PageTableEntry*>::iterator it = pageTable.find(adr / PageSize);
+		if (it == pageTable.end() || !it->second->valid)
+			continue;
+		uint64_t p_addr = it->second->ppn * PageSize;
+		bool dirty = false;
+		for (size_t i = 0; i < caches.size(); ++i)
+			caches[i]->Invalidate(p_addr, PageSize, NULL, dirty);
+		memset(mainMem->Raw(p_addr), 0, PageSize);
+	}
+	mmapPtr += size;
+	dprintf("munmap: 0x%08llx - 0x%08llx back to the mmap area.\n", addr, addr + size);
+	return 0;
+}
+
 int
-Machine::ReadMem(uint64_t addr, int size, void *value)
+Machine::ReadMem(uint64_t addr, int size, void *value, MemAccess type, uint64_t pc)
 {
 	uint64_t p_addr;
 
@@ -84,7 +209,7 @@ Machine::ReadMem(uint64_t addr, int size, void *value)
 		return false;
 	}
 
-	if (p_addr > PhysicalMemSize)
+	if (p_addr + size > mainMem->Size())
 	{
 		vprintf("[Error] Physical address out of bound. [ReadMem]\n");
 		return false;
@@ -93,7 +218,8 @@ Machine::ReadMem(uint64_t addr, int size, void *value)
 	uint8_t buf[10];
 	int hit = 0, time = 0;
 	// dprintf("before: %llu\n", *(uint64_t*)buf);
-	topStorage->HandleRequest(p_addr, size, 1, buf, hit, time);
+	Storage *top = type == AccessFetch ? instStorage : topStorage;
+	top->HandleRequest(MakeRequest(p_addr, size, 1, type, pc, cpuCount), buf, hit, time);
 	// dprintf("after:  %llu\n", *(uint64_t*)buf);
 	// printf("%d\n",time);
 
@@ -127,7 +253,7 @@ Machine::ReadMem(uint64_t addr, int size, void *value)
 }
 
 int
-Machine::WriteMem(uint64_t addr, int size, uint64_t value, bool memDirect)
+Machine::WriteMem(uint64_t addr, int size, uint64_t value, bool memDirect, uint64_t pc)
 {
 	uint64_t p_addr;
 
@@ -137,7 +263,7 @@ Machine::WriteMem(uint64_t addr, int size, uint64_t value, bool memDirect)
 		return false;
 	}
 
-	if (p_addr > PhysicalMemSize)
+	if (p_addr + size > mainMem->Size())
 	{
 		vprintf("[Error] Physical address out of bound. [WriteMem]\n");
 		return false;
@@ -168,10 +294,10 @@ Machine::WriteMem(uint64_t addr, int size, uint64_t value, bool memDirect)
 	// printf("write 0x%llx %llu\n", p_addr, value);
 	int hit = 0, time = 0;
 	if (memDirect)
-		mainMem->HandleRequest(p_addr, size, 0, buf, hit, time);
+		mainMem->HandleRequest(MakeRequest(p_addr, size, 0, AccessStore, pc, cpuCount), buf, hit, time);
 	else
 	{
-		topStorage->HandleRequest(p_addr, size, 0, buf, hit, time);
+		topStorage->HandleRequest(MakeRequest(p_addr, size, 0, AccessStore, pc, cpuCount), buf, hit, time);
 		// printf("%d\n",time);
 	}
 
@@ -189,27 +315,48 @@ Machine::Translate(uint64_t v_addr, uint64_t *p_addr, int size)
 		return false;
 	}
 
-	// translate
+	// translate, soft TLB first
 	uint64_t vpn = v_addr / PageSize, offset = v_addr % PageSize;
+	TlbEntry *t = tlb + (vpn & (TlbSize - 1));
 
-	if (pageTable.find(vpn) == pageTable.end())
+	if (t->vpn != vpn)
 	{
-		vprintf("[Error] Page not found, vpn = 0x%llx. [Translate]\n", vpn);
-		return false;
-	}
+		std::map<uint64_t, PageTableEntry*>::iterator it = pageTable.find(vpn);
+		if (it == pageTable.end())
+		{
+			if (!DemandPage(vpn))
+			{
+				vprintf("[Error] Page not found, vpn = 0x%llx. [Translate]\n", vpn);
+				return false;
+			}
+			it = pageTable.find(vpn);
+		}
 
-	PageTableEntry *entry = pageTable[vpn];
-	if (!entry->valid)
-	{
-		// TODO - load on use
-		vprintf("Page Fault (page invalid), vpn = 0x%llx. [Translate]\n", vpn);
-		return false;
+		PageTableEntry *entry = it->second;
+		if (!entry->valid)
+		{
+			// TODO - load on use
+			vprintf("Page Fault (page invalid), vpn = 0x%llx. [Translate]\n", vpn);
+			return false;
+		}
+
+		t->vpn = vpn;
+		t->ppn = entry->ppn;
+		t->host = mainMem->Raw(entry->ppn * PageSize);
 	}
 
-	*p_addr = entry->ppn * PageSize + offset;
+	*p_addr = t->ppn * PageSize + offset;
 	return true;
 }
 
+// Drop all cached translations
+void
+Machine::TlbFlush()
+{
+	for (int i = 0; i < TlbSize; ++i)
+		tlb[i].vpn = ~0ull;
+}
+
 void
 Machine::PrintPageTable(FILE *fout)
 {
@@ -234,11 +381,15 @@ Machine::PrintMem(FILE *fout, bool no_data)
 	fprintf(fout, "\n---------------- Memory ----------------\n");
 	fprintf(fout, "BASIC STATUS: \n");
 	fprintf(fout, "- Page Size:       %d\n", PageSize);
-	fprintf(fout, "- Phys. Mem Size:  %lld (%d * %d)\n", PhysicalMemSize, PhysicalPageNum, PageSize);
-	int usePage = PhysicalPageNum - freePage.size();
-	fprintf(fout, "- Phys. Mem Use:   %3.2lf%% (%d / %d)\n", (double)usePage/PhysicalPageNum, usePage, PhysicalPageNum);
+	fprintf(fout, "- Phys. Mem Size:  %llu (%llu * %d)\n", physPages * PageSize, physPages, PageSize);
+	uint64_t usePage = freePage.Used();
+	fprintf(fout, "- Phys. Mem Use:   %3.2lf%% (%llu / %llu)\n", (double)usePage/physPages, usePage, physPages);
 	fprintf(fout, "- Stack Size:      %d\n", StackPageNum * PageSize);
 	fprintf(fout, "- Stack Top Ptr.:  0x%08llx\n", StackTopPtr);
+	if (brkPtr > brkBase)
+		fprintf(fout, "- Heap:            0x%08llx - 0x%08llx\n", brkBase, brkPtr);
+	if (mmapPtr < MmapTopPtr)
+		fprintf(fout, "- Mmap Area:       0x%08llx - 0x%08llx\n", mmapPtr, MmapTopPtr);
 
 	if (no_data)
 	{
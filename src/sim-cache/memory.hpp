@@ -3,6 +3,7 @@
 
 #include "storage.hpp"
 #include <stdint.h>
+#include <vector>
 
 class PageTableEntry
 {
@@ -13,20 +14,50 @@ public:
 	bool valid;
 };
 
+// Physical page allocator, pages are never freed: the highest page not
+// yet handed out goes next, the pages in use are [next, total)
+class PageAllocator
+{
+public:
+	void Reset(uint64_t num) { total = next = num; }
+	bool Empty() { return next == 0; }
+	uint64_t Allocate() { return --next; }
+	uint64_t Used() { return total - next; }
+	void Restore(const std::vector<bool> &used);
+
+private:
+	uint64_t total, next;
+};
+
+#define TlbSize             64      // soft TLB entries, power of 2
+
+// Direct-mapped cache of page table lookups, vpn is ~0 when empty
+class TlbEntry
+{
+public:
+	uint64_t vpn;
+	uint64_t ppn;
+	uint8_t *host;      // the physical page in simulator memory
+};
+
 class Memory: public Storage
 {
 public:
-	Memory();
+	Memory(uint64_t size);
 	~Memory();
 
 	// Main access process
-	void HandleRequest(uint64_t addr, int bytes, int read,
-	                 	uint8_t *content, int &hit, int &time,
-	                 	bool prefetching = false);
+	void HandleRequest(const MemRequest &req,
+	                 	uint8_t *content, int &hit, int &time);
+
+	// Physical memory seen directly, for checkpoints
+	uint8_t *Raw(uint64_t addr) { return data + addr; }
+	uint64_t Size() { return size; }
 
 private:
-	// Memory implement
+	// Memory implement, reserved address space filled on first touch
 	uint8_t *data;
+	uint64_t size;
 
 	DISALLOW_COPY_AND_ASSIGN(Memory);
 };
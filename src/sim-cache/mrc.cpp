@@ -0,0 +1,197 @@
+#include "mrc.hpp"
+#include <string.h>
+
+#define MrcEmpty            (~0ull)     // unused stack entry
+
+StackDistance::StackDistance()
+: tree(1025, 0), owner(1025, 0), clock(0)
+{
+}
+
+void
+StackDistance::Add(uint64_t slot, int v)
+{
+	for (; slot < tree.size(); slot += slot & -slot)
+		tree[slot] += v;
+}
+
+uint64_t
+StackDistance::Sum(uint64_t slot)
+{
+	uint64_t s = 0;
+	for (; slot > 0; slot -= slot & -slot)
+		s += tree[slot];
+	return s;
+}
+
+// Renumber the live slots 1..n in order, so the tree only grows with
+// the number of distinct lines, not with the trace length
+void
+StackDistance::Compact()
+{
+	uint64_t n = 0;
+	for (uint64_t s = 1; s <= clock; ++s)
+	{
+		std::unordered_map<uint64_t, uint64_t>::iterator it = last.find(owner[s]);
+		if (it != last.end() && it->second == s)
+		{
+			owner[++n] = owner[s];
+			it->second = n;
+		}
+	}
+
+	uint64_t cap = n * 2 > 1024 ? n * 2 : 1024;
+	owner.resize(cap + 1);
+	tree.assign(cap + 1, 0);
+	for (uint64_t i = 1; i <= cap; ++i)
+	{
+		if (i <= n)
+			tree[i]++;
+		uint64_t j = i + (i & -i);
+		if (j <= cap)
+			tree[j] += tree[i];
+	}
+	clock = n;
+}
+
+int64_t
+StackDistance::Access(uint64_t line)
+{
+	if (clock + 1 >= tree.size())
+		Compact();
+
+	int64_t d = -1;
+	std::unordered_map<uint64_t, uint64_t>::iterator it = last.find(line);
+	if (it != last.end())
+	{
+		d = last.size() - Sum(it->second);
+		Add(it->second, -1);
+		it->second = ++clock;
+	}
+	else
+		last[line] = ++clock;
+
+	Add(clock, 1);
+	owner[clock] = line;
+	return d;
+}
+
+MissRatioCurve::MissRatioCurve(int line_size)
+: line_size(line_size), total(0)
+{
+	memset(full_hist, 0, sizeof full_hist);
+	memset(set_hist, 0, sizeof set_hist);
+	for (int s = 0; s < MrcSetLevels; ++s)
+	{
+		uint64_t n = (2ull << s) * MrcMaxAssoc;
+		stacks[s] = new uint64_t[n];
+		for (uint64_t i = 0; i < n; ++i)
+			stacks[s][i] = MrcEmpty;
+	}
+}
+
+MissRatioCurve::~MissRatioCurve()
+{
+	for (int s = 0; s < MrcSetLevels; ++s)
+		delete[] stacks[s];
+}
+
+void
+MissRatioCurve::Access(uint64_t addr)
+{
+	uint64_t line = addr / line_size;
+	total++;
+
+	int64_t d = full.Access(line);
+	if (d >= 0)
+	{
+		int bin = 0;
+		for (uint64_t x = d; x; x >>= 1)
+			bin++;
+		full_hist[bin]++;
+	}
+
+	for (int s = 0; s < MrcSetLevels; ++s)
+	{
+		uint64_t *st = stacks[s] + (line & ((2ull << s) - 1)) * MrcMaxAssoc;
+		int p = 0;
+		while (p < MrcMaxAssoc - 1 && st[p] != line)
+			p++;
+		if (st[p] == line)
+			set_hist[s][p]++;
+		// move to front, the last entry falls out when line was not found
+		memmove(st + 1, st, p * sizeof(uint64_t));
+		st[0] = line;
+	}
+}
+
+// 2^lines_log lines in sets of 2^assoc_log ways, -1 if not tracked
+double
+MissRatioCurve::MissRate(int lines_log, int assoc_log)
+{
+	int sets_log = lines_log - assoc_log;
+	uint64_t hits = 0;
+	if (sets_log < 0 || sets_log > MrcSetLevels)
+		return -1;
+
+	if (sets_log == 0) // fully associative: distance < lines
+	{
+		for (int b = 0; b <= lines_log && b < MrcDistBins; ++b)
+			hits += full_hist[b];
+	}
+	else
+	{
+		if (assoc_log < 0 || (1 << assoc_log) > MrcMaxAssoc)
+			return -1;
+		for (int p = 0; p < (1 << assoc_log); ++p)
+			hits += set_hist[sets_log - 1][p];
+	}
+	return total ? (double)(total - hits) / total : 0;
+}
+
+void
+MissRatioCurve::Print(FILE *fout)
+{
+	if (fout == NULL)
+	{
+		fout = stdout;
+	}
+
+	int assoc_cols = 0;
+	while ((1 << assoc_cols) <= MrcMaxAssoc)
+		assoc_cols++;
+
+	fprintf(fout, "Miss-ratio curve (LRU, %d B lines, %llu accesses, %llu distinct lines)\n",
+			line_size, (unsigned long long)total, (unsigned long long)full.Lines());
+	fprintf(fout, "%12s", "size \\ ways");
+	for (int a = 0; a < assoc_cols; ++a)
+		fprintf(fout, "%9d", 1 << a);
+	fprintf(fout, "%9s\n", "full");
+
+	// up to the first size that holds every line
+	for (int k = 0; k < 64; ++k)
+	{
+		uint64_t size = (uint64_t)line_size << k;
+		if (size >= (1ull << 30))
+			fprintf(fout, "%10llu G", (unsigned long long)(size >> 30));
+		else if (size >= (1ull << 20))
+			fprintf(fout, "%10llu M", (unsigned long long)(size >> 20));
+		else if (size >= (1ull << 10))
+			fprintf(fout, "%10llu K", (unsigned long long)(size >> 10));
+		else
+			fprintf(fout, "%10llu B", (unsigned long long)size);
+
+		for (int a = 0; a < assoc_cols; ++a)
+		{
+			double m = MissRate(k, a);
+			if (m < 0)
+				fprintf(fout, "%9s", "-");
+			else
+				fprintf(fout, "%8.2lf%%", m * 100);
+		}
+		fprintf(fout, "%8.2lf%%\n", MissRate(k, k) * 100);
+
+		if ((1ull << k) >= full.Lines())
+			break;
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef MRC_HEADER
+#define MRC_HEADER
+
+#include "utils.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <unordered_map>
+
+#define MrcMaxAssoc         16          // widest set-associative column
+#define MrcSetLevels        15          // set counts 2, 4, ... 2^14
+#define MrcDistBins         65          // bit length of a 64-bit distance
+
+// LRU stack distance of every access (Mattson), the number of distinct
+// lines touched since the previous access to the same line. A Fenwick
+// tree over access slots counts the lines whose last access is newer.
+class StackDistance
+{
+public:
+	StackDistance();
+
+	// distance of line, -1 on its first access
+	int64_t Access(uint64_t line);
+	uint64_t Lines() { return last.size(); }
+
+private:
+	void Add(uint64_t slot, int v);
+	uint64_t Sum(uint64_t slot);    // live slots in [1, slot]
+	void Compact();
+
+	std::vector<int> tree;          // Fenwick tree, 1-based
+	std::vector<uint64_t> owner;    // line accessed in each slot
+	std::unordered_map<uint64_t, uint64_t> last;    // line -> slot of its last access
+	uint64_t clock;                 // last slot used
+
+	DISALLOW_COPY_AND_ASSIGN(StackDistance);
+};
+
+// Miss ratios of LRU caches of every power of 2 size for one line size,
+// from a single pass over the trace: fully associative from the stack
+// distance, set-associative up to MrcMaxAssoc ways from a bounded LRU
+// stack per set for each power of 2 set count. Write-allocate, no
+// prefetching.
+class MissRatioCurve
+{
+public:
+	MissRatioCurve(int line_size);
+	~MissRatioCurve();
+
+	void Access(uint64_t addr);
+	void Print(FILE *fout = NULL);
+
+private:
+	double MissRate(int lines_log, int assoc_log);
+
+	int line_size;
+	uint64_t total;
+	StackDistance full;
+	uint64_t full_hist[MrcDistBins];    // by bit length of the distance
+	uint64_t *stacks[MrcSetLevels];     // 2^(s+1) sets, MRU way first
+	uint64_t set_hist[MrcSetLevels][MrcMaxAssoc];
+
+	DISALLOW_COPY_AND_ASSIGN(MissRatioCurve);
+};
+
+#endif
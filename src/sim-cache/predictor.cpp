@@ -1,5 +1,6 @@
 #include "predictor.hpp"
 #include "utils.hpp"
+#include "checkpoint.hpp"
 
 char *pred_str[30] =
 {
@@ -99,3 +100,24 @@ Predictor::Update(uint64_t adr, bool real)
 	}
 }
 
+bool
+Predictor::Save(FILE *f)
+{
+	int m = mode;
+	return CkptWrite(f, &m, sizeof m)
+		&& CkptWrite(f, pred_state, PredCacheSize * sizeof(uint64_t));
+}
+
+bool
+Predictor::Load(FILE *f)
+{
+	int m;
+	if (!CkptRead(f, &m, sizeof m))
+		return false;
+	if (m != mode)
+	{
+		vprintf("[Error] Checkpoint uses predictor %d. [Predictor::Load]\n", m);
+		return false;
+	}
+	return CkptRead(f, pred_state, PredCacheSize * sizeof(uint64_t));
+}
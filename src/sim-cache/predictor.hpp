@@ -5,6 +5,7 @@
 #define PredTypeNum			5
 
 #include <stdint.h>
+#include <stdio.h>
 
 enum PRED_TYPE
 {
@@ -26,6 +27,8 @@ public:
 	void Init();
 	bool Predict(uint64_t adr);
 	void Update(uint64_t adr, bool real);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
 	char* Name(){ return pred_str[mode]; }
 };
 
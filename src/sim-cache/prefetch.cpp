@@ -0,0 +1,268 @@
+#include "prefetch.hpp"
+#include "checkpoint.hpp"
+
+char *prefetch_type_str[40] =
+{
+	"NONE",
+	"NEXT_LINE",
+	"STRIDE",
+	"STREAM",
+	"BEST_OFFSET"
+};
+
+// Offsets with no prime factor above 5 (Michaud's list, up to 64 lines)
+static const int bo_offsets[BoOffsetNum] =
+{
+	1, 2, 3, 4, 5, 6, 8, 9, 10, 12, 15, 16, 18, 20,
+	24, 25, 27, 30, 32, 36, 40, 45, 48, 50, 54, 60, 64
+};
+
+void
+PrefetchQueue::Push(uint64_t line)
+{
+	for (int i = 0; i < count; ++i)
+		if (lines[(head + i) % PrefetchQueueSize] == line)
+			return;
+	if (count == PrefetchQueueSize)
+	{
+		head = (head + 1) % PrefetchQueueSize;
+		count--;
+	}
+	lines[(head + count++) % PrefetchQueueSize] = line;
+}
+
+bool
+PrefetchQueue::Pop(uint64_t &line)
+{
+	if (count == 0)
+		return false;
+	line = lines[head];
+	head = (head + 1) % PrefetchQueueSize;
+	count--;
+	return true;
+}
+
+Prefetcher *
+Prefetcher::Create(PREFETCH_TYPE t, int degree, int distance)
+{
+	switch (t)
+	{
+		case NO_PREFETCH: return NULL;
+		case NEXT_LINE:   return new NextLinePrefetcher(degree, distance);
+		case STRIDE:      return new StridePrefetcher(degree, distance);
+		case STREAM:      return new StreamPrefetcher(degree, distance);
+		case BEST_OFFSET: return new BestOffsetPrefetcher(degree, distance);
+	}
+	return NULL;
+}
+
+void
+Prefetcher::Issue(PrefetchQueue &q, uint64_t base, int64_t delta)
+{
+	for (int k = distance; k < distance + degree; ++k)
+	{
+		int64_t off = delta * k;
+		if (off < 0 && base < (uint64_t)-off) // below address 0
+			continue;
+		q.Push(base + off);
+	}
+}
+
+// NEXT_LINE
+
+void
+NextLinePrefetcher::Access(uint64_t line, uint64_t pc, bool miss, bool pf_hit, PrefetchQueue &q)
+{
+	if (miss)
+		Issue(q, line, 1);
+}
+
+// STRIDE
+
+StridePrefetcher::StridePrefetcher(int degree, int distance)
+: Prefetcher(degree, distance), table(StrideTableSize, Entry())
+{
+}
+
+void
+StridePrefetcher::Access(uint64_t line, uint64_t pc, bool miss, bool pf_hit, PrefetchQueue &q)
+{
+	Entry &e = table[(pc >> 2) % StrideTableSize];
+	if (e.pc != pc)
+	{
+		e.pc = pc;
+		e.last = line;
+		e.stride = 0;
+		e.conf = 0;
+		return;
+	}
+
+	int64_t s = line - e.last;
+	if (s == 0) // same line
+		return;
+	if (s == e.stride)
+	{
+		if (e.conf < StrideConfMax)
+			e.conf++;
+	}
+	else if (e.conf > 0)
+		e.conf--;
+	else
+		e.stride = s;
+	e.last = line;
+
+	if (e.conf >= StrideConfIssue)
+		Issue(q, line, e.stride);
+}
+
+bool
+StridePrefetcher::Save(FILE *f)
+{
+	return CkptWriteVec(f, table);
+}
+
+bool
+StridePrefetcher::Load(FILE *f)
+{
+	return CkptReadVec(f, table);
+}
+
+// STREAM
+
+StreamPrefetcher::StreamPrefetcher(int degree, int distance)
+: Prefetcher(degree, distance), streams(StreamNum, Stream()), clock(0)
+{
+}
+
+void
+StreamPrefetcher::Access(uint64_t line, uint64_t pc, bool miss, bool pf_hit, PrefetchQueue &q)
+{
+	clock++;
+	for (int i = 0; i < StreamNum; ++i)
+	{
+		Stream &s = streams[i];
+		int64_t d = line - s.head;
+		if (s.stamp == 0 || d < -StreamWindow || d > StreamWindow)
+			continue;
+
+		s.stamp = clock;
+		if (d == 0)
+			return;
+		int dir = d > 0 ? 1 : -1;
+		if (dir == s.dir)
+			s.conf++;
+		else
+		{
+			s.dir = dir;
+			s.conf = 1;
+			s.issued = line;
+		}
+		s.head = line;
+
+		if (s.conf >= StreamConfIssue)
+		{
+			// only the lines past the furthest one already issued
+			for (int k = distance; k < distance + degree; ++k)
+			{
+				if (dir < 0 && line < (uint64_t)k)
+					break;
+				uint64_t p = line + (int64_t)dir * k;
+				if ((int64_t)(p - s.issued) * dir > 0)
+				{
+					q.Push(p);
+					s.issued = p;
+				}
+			}
+		}
+		return;
+	}
+
+	if (!miss)
+		return;
+	int vic = 0;
+	for (int i = 1; i < StreamNum; ++i)
+		if (streams[i].stamp < streams[vic].stamp)
+			vic = i;
+	streams[vic].head = streams[vic].issued = line;
+	streams[vic].stamp = clock;
+	streams[vic].dir = streams[vic].conf = 0;
+}
+
+bool
+StreamPrefetcher::Save(FILE *f)
+{
+	return CkptWrite(f, &clock, sizeof clock) && CkptWriteVec(f, streams);
+}
+
+bool
+StreamPrefetcher::Load(FILE *f)
+{
+	return CkptRead(f, &clock, sizeof clock) && CkptReadVec(f, streams);
+}
+
+// BEST_OFFSET
+
+BestOffsetPrefetcher::BestOffsetPrefetcher(int degree, int distance)
+: Prefetcher(degree, distance), rr(BoRrSize, ~0ull), score(BoOffsetNum, 0),
+  test(0), round(0), best(0)
+{
+}
+
+// Score the next offset of the round, a phase ends when one offset
+// reaches BoScoreMax or after BoRoundMax rounds
+void
+BestOffsetPrefetcher::Learn(uint64_t line)
+{
+	uint64_t base = line - bo_offsets[test];
+	if (line >= (uint64_t)bo_offsets[test] && Recent(base) == base)
+		score[test]++;
+
+	bool end = score[test] >= BoScoreMax;
+	if (++test == BoOffsetNum)
+	{
+		test = 0;
+		end = end || ++round >= BoRoundMax;
+	}
+	if (!end)
+		return;
+
+	int b = 0;
+	for (int i = 1; i < BoOffsetNum; ++i)
+		if (score[i] > score[b])
+			b = i;
+	best = score[b] > BoBadScore ? b : -1;
+	score.assign(BoOffsetNum, 0);
+	test = round = 0;
+}
+
+void
+BestOffsetPrefetcher::Access(uint64_t line, uint64_t pc, bool miss, bool pf_hit, PrefetchQueue &q)
+{
+	if (!miss && !pf_hit)
+		return;
+	Learn(line);
+	if (best >= 0)
+		Issue(q, line, bo_offsets[best]);
+	// prefetches fill at once, so the base of line + offset is line itself
+	Recent(line) = line;
+}
+
+bool
+BestOffsetPrefetcher::Save(FILE *f)
+{
+	int head[3] = {test, round, best};
+	return CkptWrite(f, head, sizeof head) && CkptWriteVec(f, rr) && CkptWriteVec(f, score);
+}
+
+bool
+BestOffsetPrefetcher::Load(FILE *f)
+{
+	int head[3];
+	if (!CkptRead(f, head, sizeof head) || head[2] < -1 || head[2] >= BoOffsetNum
+		|| head[0] < 0 || head[0] >= BoOffsetNum)
+		return false;
+	test = head[0];
+	round = head[1];
+	best = head[2];
+	return CkptReadVec(f, rr) && CkptReadVec(f, score);
+}
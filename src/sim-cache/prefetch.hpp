@@ -0,0 +1,154 @@
+#ifndef PREFETCH_HEADER
+#define PREFETCH_HEADER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define PrefetchTypeNum     5
+#define PrefetchQueueSize   32          // pending lines, the oldest is dropped when full
+#define StrideTableSize     64          // STRIDE: reference prediction table entries
+#define StrideConfMax       3
+#define StrideConfIssue     2           // STRIDE: confirmations before issuing
+#define StreamNum           16          // STREAM: concurrently tracked streams
+#define StreamWindow        16          // STREAM: lines around the stream head that train it
+#define StreamConfIssue     2           // STREAM: accesses in one direction before issuing
+#define BoOffsetNum         27
+#define BoRrSize            256         // BEST_OFFSET: recent requests table entries
+#define BoScoreMax          31
+#define BoRoundMax          100
+#define BoBadScore          1           // BEST_OFFSET: best score at or below turns it off
+#define PfDegreeMax         16          // throttling: highest degree
+#define PfAccLow            40          // throttling: accuracy % below lowers the degree
+#define PfLateHigh          10          // throttling: late % of useful at or above raises it
+
+enum PREFETCH_TYPE
+{
+	NO_PREFETCH,
+	NEXT_LINE,
+	STRIDE,
+	STREAM,
+	BEST_OFFSET
+};
+
+extern char *prefetch_type_str[40];
+
+// Line addresses waiting to be prefetched, duplicates are merged
+class PrefetchQueue
+{
+public:
+	PrefetchQueue() : head(0), count(0) {}
+
+	void Push(uint64_t line);
+	bool Pop(uint64_t &line);
+
+private:
+	uint64_t lines[PrefetchQueueSize];
+	int head, count;
+};
+
+// Prefetch engine of one cache level. Sees the demand accesses in line
+// addresses (address / line size) and pushes the lines to fetch.
+// Candidates are base + delta * k for k in [distance, distance + degree).
+class Prefetcher
+{
+public:
+	Prefetcher(int degree, int distance) : degree(degree), distance(distance) {}
+	virtual ~Prefetcher() {}
+
+	// demand access to line by the instruction at pc, miss: not in the cache,
+	// pf_hit: first demand hit on a prefetched line
+	virtual void Access(uint64_t line, uint64_t pc, bool miss, bool pf_hit, PrefetchQueue &q) = 0;
+
+	virtual bool Save(FILE *f) { return true; }
+	virtual bool Load(FILE *f) { return true; }
+
+	int Degree() { return degree; }
+	void SetDegree(int d) { degree = d; }
+
+	// NULL for an unknown type or NO_PREFETCH
+	static Prefetcher *Create(PREFETCH_TYPE t, int degree, int distance);
+
+protected:
+	void Issue(PrefetchQueue &q, uint64_t base, int64_t delta);
+
+	int degree, distance;
+};
+
+// The lines following a miss
+class NextLinePrefetcher: public Prefetcher
+{
+public:
+	NextLinePrefetcher(int degree, int distance) : Prefetcher(degree, distance) {}
+
+	void Access(uint64_t line, uint64_t pc, bool miss, bool pf_hit, PrefetchQueue &q);
+};
+
+// Reference prediction table indexed by pc (Chen & Baer), issues once
+// the same line stride was seen StrideConfIssue times in a row
+class StridePrefetcher: public Prefetcher
+{
+public:
+	StridePrefetcher(int degree, int distance);
+
+	void Access(uint64_t line, uint64_t pc, bool miss, bool pf_hit, PrefetchQueue &q);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
+
+private:
+	class Entry
+	{
+	public:
+		uint64_t pc, last;
+		int64_t stride;
+		int conf;
+	};
+	std::vector<Entry> table;
+};
+
+// Multi-stream detector: a miss outside every stream starts one, accesses
+// near a stream head move it and confirm its direction. Confirmed streams
+// run ahead of the head, each line is issued once.
+class StreamPrefetcher: public Prefetcher
+{
+public:
+	StreamPrefetcher(int degree, int distance);
+
+	void Access(uint64_t line, uint64_t pc, bool miss, bool pf_hit, PrefetchQueue &q);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
+
+private:
+	class Stream
+	{
+	public:
+		uint64_t head, issued;  // last line accessed, furthest line prefetched
+		uint64_t stamp;         // last use, 0: unused, the oldest is replaced
+		int dir, conf;          // dir 0: not known yet
+	};
+	std::vector<Stream> streams;
+	uint64_t clock;
+};
+
+// Best-offset prefetching (Michaud, HPCA 2016): offsets are scored by how
+// often line - offset was recently requested, each learning phase picks
+// the best one as the delta. Misses and prefetched hits train and issue.
+class BestOffsetPrefetcher: public Prefetcher
+{
+public:
+	BestOffsetPrefetcher(int degree, int distance);
+
+	void Access(uint64_t line, uint64_t pc, bool miss, bool pf_hit, PrefetchQueue &q);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
+
+private:
+	void Learn(uint64_t line);
+	uint64_t &Recent(uint64_t line) { return rr[(line ^ (line >> 8)) % BoRrSize]; }
+
+	std::vector<uint64_t> rr;       // recent requests, prefetch bases when on
+	std::vector<int> score;
+	int test, round, best;          // best: offset index, -1 while off
+};
+
+#endif
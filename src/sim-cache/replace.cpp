@@ -0,0 +1,306 @@
+#include "replace.hpp"
+#include "checkpoint.hpp"
+
+char *cache_method_str[40] =
+{
+	"LRU",
+	"TWO_QUEUE",
+	"TREE_PLRU",
+	"SRRIP",
+	"BRRIP",
+	"DRRIP",
+	"LFU"
+};
+
+ReplacePolicy *
+ReplacePolicy::Create(CACHE_METHOD m, int sets, int assoc)
+{
+	switch (m)
+	{
+		case LRU:       return new LruPolicy(sets, assoc);
+		case TWO_QUEUE: return new TwoQueuePolicy(sets, assoc);
+		case TREE_PLRU: return new TreePlruPolicy(sets, assoc);
+		case SRRIP:
+		case BRRIP:
+		case DRRIP:     return new RripPolicy(sets, assoc, m);
+		case LFU:       return new LfuPolicy(sets, assoc);
+	}
+	return NULL;
+}
+
+// LRU
+
+LruPolicy::LruPolicy(int sets, int assoc)
+: ReplacePolicy(sets, assoc), stamp((size_t)sets * assoc, 0), clock(0)
+{
+}
+
+int
+LruPolicy::Victim(int set)
+{
+	uint64_t *s = &stamp[(size_t)set * assoc];
+	int vic_id = 0;
+	for (int i = 1; i < assoc; ++i)
+		if (s[i] < s[vic_id])
+			vic_id = i;
+	return vic_id;
+}
+
+bool
+LruPolicy::Save(FILE *f)
+{
+	return CkptWrite(f, &clock, sizeof clock) && CkptWriteVec(f, stamp);
+}
+
+bool
+LruPolicy::Load(FILE *f)
+{
+	return CkptRead(f, &clock, sizeof clock) && CkptReadVec(f, stamp);
+}
+
+// TWO_QUEUE
+
+TwoQueuePolicy::TwoQueuePolicy(int sets, int assoc)
+: LruPolicy(sets, assoc), inlru((size_t)sets * assoc, 0)
+{
+}
+
+void
+TwoQueuePolicy::Touch(int set, int way)
+{
+	inlru[set * assoc + way] = 1; // push into lru queue
+	LruPolicy::Touch(set, way);
+}
+
+void
+TwoQueuePolicy::Insert(int set, int way)
+{
+	inlru[set * assoc + way] = 0;
+	LruPolicy::Insert(set, way);
+}
+
+void
+TwoQueuePolicy::InsertDistant(int set, int way)
+{
+	inlru[set * assoc + way] = 0;
+	LruPolicy::InsertDistant(set, way);
+}
+
+int
+TwoQueuePolicy::Victim(int set)
+{
+	uint64_t *s = &stamp[(size_t)set * assoc];
+	uint8_t *q = &inlru[(size_t)set * assoc];
+	int vic_id = -1;
+	for (int i = 0; i < assoc; ++i)
+		if (!q[i] && (vic_id == -1 || s[i] < s[vic_id])) // in fifo queue
+			vic_id = i;
+
+	if (vic_id == -1) // find in lru queue
+		vic_id = LruPolicy::Victim(set);
+	return vic_id;
+}
+
+bool
+TwoQueuePolicy::Save(FILE *f)
+{
+	return LruPolicy::Save(f) && CkptWriteVec(f, inlru);
+}
+
+bool
+TwoQueuePolicy::Load(FILE *f)
+{
+	return LruPolicy::Load(f) && CkptReadVec(f, inlru);
+}
+
+// TREE_PLRU
+
+TreePlruPolicy::TreePlruPolicy(int sets, int assoc)
+: ReplacePolicy(sets, assoc)
+{
+	for (leaves = 1; leaves < assoc; leaves <<= 1)
+		;
+	bits.assign((size_t)sets * leaves, 0);
+}
+
+void
+TreePlruPolicy::Touch(int set, int way)
+{
+	uint8_t *b = &bits[(size_t)set * leaves];
+	int node = 0, lo = 0;
+	for (int size = leaves; size > 1; size >>= 1)
+	{
+		int half = size >> 1;
+		if (way < lo + half)
+		{
+			b[node] = 1; // point away from way
+			node = 2 * node + 1;
+		}
+		else
+		{
+			b[node] = 0;
+			node = 2 * node + 2;
+			lo += half;
+		}
+	}
+}
+
+// Every node on the path points toward way
+void
+TreePlruPolicy::InsertDistant(int set, int way)
+{
+	uint8_t *b = &bits[(size_t)set * leaves];
+	int node = 0, lo = 0;
+	for (int size = leaves; size > 1; size >>= 1)
+	{
+		int half = size >> 1;
+		if (way < lo + half)
+		{
+			b[node] = 0;
+			node = 2 * node + 1;
+		}
+		else
+		{
+			b[node] = 1;
+			node = 2 * node + 2;
+			lo += half;
+		}
+	}
+}
+
+int
+TreePlruPolicy::Victim(int set)
+{
+	uint8_t *b = &bits[(size_t)set * leaves];
+	int node = 0, lo = 0;
+	for (int size = leaves; size > 1; size >>= 1)
+	{
+		int half = size >> 1;
+		if (b[node] && lo + half < assoc)
+		{
+			node = 2 * node + 2;
+			lo += half;
+		}
+		else
+			node = 2 * node + 1;
+	}
+	return lo;
+}
+
+bool
+TreePlruPolicy::Save(FILE *f)
+{
+	return CkptWriteVec(f, bits);
+}
+
+bool
+TreePlruPolicy::Load(FILE *f)
+{
+	return CkptReadVec(f, bits);
+}
+
+// SRRIP / BRRIP / DRRIP
+
+RripPolicy::RripPolicy(int sets, int assoc, CACHE_METHOD m)
+: ReplacePolicy(sets, assoc), mode(m), rrpv((size_t)sets * assoc, RripMax),
+  fills(0), psel(PselMax / 2)
+{
+}
+
+// Insertion policy of set, DRRIP leader sets train psel on their misses
+bool
+RripPolicy::Bimodal(int set)
+{
+	if (mode != DRRIP)
+		return mode == BRRIP;
+
+	switch (set % DuelPeriod)
+	{
+		case 0:
+			if (psel < PselMax) psel++;
+			return false;
+		case 1:
+			if (psel > 0) psel--;
+			return true;
+		default:
+			return psel > PselMax / 2;
+	}
+}
+
+void
+RripPolicy::Insert(int set, int way)
+{
+	uint8_t v = RripMax - 1;
+	if (Bimodal(set) && ++fills % BrripPeriod != 0)
+		v = RripMax;
+	rrpv[set * assoc + way] = v;
+}
+
+int
+RripPolicy::Victim(int set)
+{
+	uint8_t *r = &rrpv[(size_t)set * assoc];
+	int vic_id = 0;
+	for (int i = 1; i < assoc; ++i)
+		if (r[i] > r[vic_id])
+			vic_id = i;
+
+	// age the set until the victim reaches the distant value
+	uint8_t age = RripMax - r[vic_id];
+	if (age)
+		for (int i = 0; i < assoc; ++i)
+			r[i] += age;
+	return vic_id;
+}
+
+bool
+RripPolicy::Save(FILE *f)
+{
+	return CkptWrite(f, &fills, sizeof fills) && CkptWrite(f, &psel, sizeof psel)
+		&& CkptWriteVec(f, rrpv);
+}
+
+bool
+RripPolicy::Load(FILE *f)
+{
+	return CkptRead(f, &fills, sizeof fills) && CkptRead(f, &psel, sizeof psel)
+		&& CkptReadVec(f, rrpv);
+}
+
+// LFU
+
+LfuPolicy::LfuPolicy(int sets, int assoc)
+: ReplacePolicy(sets, assoc), count((size_t)sets * assoc, 0)
+{
+}
+
+void
+LfuPolicy::Touch(int set, int way)
+{
+	uint32_t &c = count[set * assoc + way];
+	if (c != UINT32_MAX)
+		c++;
+}
+
+int
+LfuPolicy::Victim(int set)
+{
+	uint32_t *c = &count[(size_t)set * assoc];
+	int vic_id = 0;
+	for (int i = 1; i < assoc; ++i)
+		if (c[i] < c[vic_id])
+			vic_id = i;
+	return vic_id;
+}
+
+bool
+LfuPolicy::Save(FILE *f)
+{
+	return CkptWriteVec(f, count);
+}
+
+bool
+LfuPolicy::Load(FILE *f)
+{
+	return CkptReadVec(f, count);
+}
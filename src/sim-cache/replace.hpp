@@ -0,0 +1,150 @@
+#ifndef REPLACE_HEADER
+#define REPLACE_HEADER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define ReplaceMethodNum    7
+#define RripMax             3           // 2-bit re-reference prediction value
+#define BrripPeriod         32          // BRRIP inserts near once per period
+#define DuelPeriod          32          // DRRIP: one leader set of each kind per period
+#define PselMax             1023        // DRRIP: 10-bit policy selector
+
+enum CACHE_METHOD
+{
+	LRU,
+	TWO_QUEUE,
+	TREE_PLRU,
+	SRRIP,
+	BRRIP,
+	DRRIP,
+	LFU
+};
+
+extern char *cache_method_str[40];
+
+// Replacement state of one cache. Hits and fills update a single way,
+// only picking a victim looks at the whole set.
+class ReplacePolicy
+{
+public:
+	ReplacePolicy(int sets, int assoc) : sets(sets), assoc(assoc) {}
+	virtual ~ReplacePolicy() {}
+
+	// way was hit
+	virtual void Touch(int set, int way) = 0;
+	// way was filled on a miss
+	virtual void Insert(int set, int way) = 0;
+	// way was filled with a line predicted dead, it is the next victim
+	virtual void InsertDistant(int set, int way) = 0;
+	// way to evict, every way of set is valid
+	virtual int Victim(int set) = 0;
+
+	virtual bool Save(FILE *f) = 0;
+	virtual bool Load(FILE *f) = 0;
+
+	// NULL for an unknown method
+	static ReplacePolicy *Create(CACHE_METHOD m, int sets, int assoc);
+
+protected:
+	int sets, assoc;
+};
+
+// True LRU: timestamp of the last use, victim is the oldest
+class LruPolicy: public ReplacePolicy
+{
+public:
+	LruPolicy(int sets, int assoc);
+
+	void Touch(int set, int way) { stamp[set * assoc + way] = ++clock; }
+	void Insert(int set, int way) { stamp[set * assoc + way] = ++clock; }
+	void InsertDistant(int set, int way) { stamp[set * assoc + way] = 0; }
+	int Victim(int set);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
+
+protected:
+	std::vector<uint64_t> stamp;
+	uint64_t clock;
+};
+
+// Fills enter a fifo queue, a hit promotes the line to the lru queue.
+// Victims come from the fifo queue first.
+class TwoQueuePolicy: public LruPolicy
+{
+public:
+	TwoQueuePolicy(int sets, int assoc);
+
+	void Touch(int set, int way);
+	void Insert(int set, int way);
+	void InsertDistant(int set, int way);
+	int Victim(int set);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
+
+private:
+	std::vector<uint8_t> inlru;
+};
+
+// Binary tree over the ways, each node points to the less recently
+// used half. Ways beyond a non power of 2 assoc are never chosen.
+class TreePlruPolicy: public ReplacePolicy
+{
+public:
+	TreePlruPolicy(int sets, int assoc);
+
+	void Touch(int set, int way);
+	void Insert(int set, int way) { Touch(set, way); }
+	void InsertDistant(int set, int way);
+	int Victim(int set);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
+
+private:
+	int leaves;
+	std::vector<uint8_t> bits;  // leaves - 1 nodes per set, 1: victim on the right
+};
+
+// Re-reference interval prediction (Jaleel et al., ISCA 2010). SRRIP
+// inserts at RripMax - 1, BRRIP mostly at RripMax, DRRIP picks between
+// them by set dueling.
+class RripPolicy: public ReplacePolicy
+{
+public:
+	RripPolicy(int sets, int assoc, CACHE_METHOD m);
+
+	void Touch(int set, int way) { rrpv[set * assoc + way] = 0; }
+	void Insert(int set, int way);
+	void InsertDistant(int set, int way) { rrpv[set * assoc + way] = RripMax; }
+	int Victim(int set);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
+
+private:
+	bool Bimodal(int set);
+
+	CACHE_METHOD mode;
+	std::vector<uint8_t> rrpv;
+	uint32_t fills;     // BRRIP insertion counter
+	int psel;
+};
+
+// Least frequently used, hit counts are not aged
+class LfuPolicy: public ReplacePolicy
+{
+public:
+	LfuPolicy(int sets, int assoc);
+
+	void Touch(int set, int way);
+	void Insert(int set, int way) { count[set * assoc + way] = 1; }
+	void InsertDistant(int set, int way) { count[set * assoc + way] = 0; }
+	int Victim(int set);
+	bool Save(FILE *f);
+	bool Load(FILE *f);
+
+private:
+	std::vector<uint32_t> count;
+};
+
+#endif
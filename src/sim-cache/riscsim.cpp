@@ -1,5 +1,6 @@
 #include "machine.hpp"
 #include "utils.hpp"
+#include "decode.hpp"
 #include <stdio.h>
 
 const char *op_str[60] =
@@ -27,27 +28,6 @@ const char *reg_str[34] = {
     "t5", "t6", "pc", "p_pc"  
 };
 
-inline uint32_t
-maskvalue(int len, uint32_t &value)
-{
-	uint32_t res = value & ((1 << len) - 1);
-	value >>= len;
-	return res;
-}
-
-inline int64_t
-signext64(int len_src, uint64_t value)
-{
-	uint64_t sign = (1ll << (len_src - 1));
-	if (sign & value) // neg
-		return value | ((-1ll) ^ ((1ll << len_src) - 1));
-	else
-		return value & ((1ll << len_src) - 1);
-}
-
-bool predict_pc_updated;
-uint64_t f_pred_pc;
-
 int
 Machine::Fetch()
 {
@@ -56,7 +36,7 @@ Machine::Fetch()
 	dprintf("\n**** Fetch Stage [%d] ****\n", cycCount);
 	predict_pc_updated = false;
 
-	if (F_reg.bubble) // output bubble
+	if (F_reg.bubble || draining) // output bubble
 	{
 		F_reg.bubble = false;
 		F_reg.stall  = false;
@@ -73,8 +53,10 @@ Machine::Fetch()
 
 	dprintf("fetching operation from 0x%016llx.\n", inst_adr);
 
+	if (!fetchRetry || inst->adr != inst_adr)
+		F_reg.seq = ++fetchSeq;
 	inst->adr = inst_adr;
-	if ((use_cyc = ReadMem(inst_adr, 4, (void*)&(inst->value))) == 0)
+	if ((use_cyc = ReadMem(inst_adr, 4, (void*)&(inst->value), AccessFetch, inst_adr)) == 0)
 	{
 		vprintf("--Can not fetch operation. [Fetch]\n");
 		return 0;
@@ -82,6 +64,7 @@ Machine::Fetch()
 	vprintf("[F] [0x%016llx] need decode 0x%08llx\n", inst_adr, inst->value);
 
 	dprintf("op_value: 0x%08x\n", inst->value);
+	Trace(F_reg, TraceOccupy, StageF);
 	f_reg = F_reg;
 	f_reg.bubble = false;
 	f_reg.stall  = false;
@@ -92,17 +75,7 @@ Machine::Fetch()
 		if (f_reg.pred_j) // predict jump
 		{
 			dprintf("predictor: branch taken.\n");
-			uint64_t jmp_imm = 0;
-			uint32_t tmp_val = inst->value;
-			maskvalue(7, tmp_val);
-			jmp_imm = 0;
-			jmp_imm |= (maskvalue(1, tmp_val) << 11);
-			jmp_imm |= (maskvalue(4, tmp_val) << 1);
-			maskvalue(13, tmp_val);
-			jmp_imm |= (maskvalue(6, tmp_val) << 5);
-			jmp_imm |= (maskvalue(1, tmp_val) << 12);
-			jmp_imm = signext64(13, jmp_imm);
-
+			uint64_t jmp_imm = ImmSB(inst->value);
 			f_pred_pc = inst->adr + jmp_imm;
 		}
 		else
@@ -113,15 +86,7 @@ Machine::Fetch()
 	}
 	else if ((inst->value & 0x7f) == 0x6f) // jal
 	{
-		uint64_t jmp_imm = 0;
-		uint32_t tmp_val = inst->value;
-		maskvalue(12, tmp_val);
-		jmp_imm |= (maskvalue(8, tmp_val) << 12);
-		jmp_imm |= (maskvalue(1, tmp_val) << 11);
-		jmp_imm |= (maskvalue(10, tmp_val) << 1);
-		jmp_imm |= (maskvalue(1, tmp_val) << 20);
-		jmp_imm = signext64(21, jmp_imm);
-
+		uint64_t jmp_imm = ImmUJ(inst->value);
 		f_pred_pc = inst->adr + jmp_imm;
 		dprintf("pipeline: JAL prefetch, jump to 0x%08llx.\n", inst->adr + jmp_imm);
 	}
@@ -134,9 +99,6 @@ Machine::Fetch()
 	return use_cyc;
 }
 
-bool data_forwarded_rs1;
-bool data_forwarded_rs2;
-
 int
 Machine::Decode()
 {
@@ -153,445 +115,20 @@ Machine::Decode()
 		return 1;
 	}
 
-	Instruction *inst = &D_reg.inst;	
-	uint32_t value = inst->value;
-	uint32_t opcode = maskvalue(7, value);
-	inst->opcode = opcode;
+	Instruction *inst = &D_reg.inst;
+	Trace(D_reg, TraceOccupy, StageD);
 
-	inst->rd  = 0;
-	inst->rs1 = 0;
-	inst->rs2 = 0;
-	// instruction type
-	switch (opcode)
+	// decoded instruction cache, hit only if the fetched word is unchanged
+	Instruction *cached = decodeCache + ((inst->adr >> 2) & (DecodeCacheSize - 1));
+	if (cached->adr == inst->adr && cached->value == inst->value)
 	{
-		case 0x33:
-		case 0x3b:
-			inst->type = Rtype;
-			inst->rd = maskvalue(5, value);
-			inst->func3 = maskvalue(3, value);
-			inst->rs1 = maskvalue(5, value);
-			inst->rs2 = maskvalue(5, value);
-			inst->func7 = maskvalue(7, value);
-			break;
-		case 0x03:
-		case 0x13:
-		case 0x1b:
-		case 0x67:
-		case 0x73:
-			inst->type = Itype;
-			inst->rd = maskvalue(5, value);
-			inst->func3 = maskvalue(3, value);
-			inst->rs1 = maskvalue(5, value);
-			inst->imm = maskvalue(12, value);
-			inst->func7 = (((inst->value) >> 26) & 0x3f);
-			inst->imm = signext64(12, inst->imm);
-			break;
-		case 0x23:
-			inst->type = Stype;
-			inst->imm = 0;
-			inst->imm |= maskvalue(5, value);
-			inst->func3 = maskvalue(3, value);
-			inst->rs1 = maskvalue(5, value);
-			inst->rs2 = maskvalue(5, value);
-			inst->imm |= (maskvalue(7, value) << 5);
-			inst->imm = signext64(12, inst->imm);
-			break;
-		case 0x63:
-			inst->type = SBtype;
-			inst->imm = 0;
-			inst->imm |= (maskvalue(1, value) << 11);
-			inst->imm |= (maskvalue(4, value) << 1);
-			inst->func3 = maskvalue(3, value);
-			inst->rs1 = maskvalue(5, value);
-			inst->rs2 = maskvalue(5, value);
-			inst->imm |= (maskvalue(6, value) << 5);
-			inst->imm |= (maskvalue(1, value) << 12);
-			inst->imm = signext64(13, inst->imm);
-			break;
-		case 0x17:
-		case 0x37:
-			inst->type = Utype;
-			inst->rd = maskvalue(5, value);
-			inst->imm = (maskvalue(20, value) << 12);
-			inst->imm = signext64(32, inst->imm);
-			break;
-		case 0x6f:
-			inst->type = UJtype;
-			inst->rd = maskvalue(5, value);
-			inst->imm = 0;
-			inst->imm |= (maskvalue(8, value) << 12);
-			inst->imm |= (maskvalue(1, value) << 11);
-			inst->imm |= (maskvalue(10, value) << 1);
-			inst->imm |= (maskvalue(1, value) << 20);
-			inst->imm = signext64(21, inst->imm);
-			break;
-		default:
-			vprintf("[Error] Unknown opcode 0x%02x. [Decode]\n", opcode);
-			return 0;
+		*inst = *cached;
 	}
-
-
-	// optype 
-	switch (inst->type)
+	else
 	{
-		case Rtype:
-			switch (inst->opcode)
-			{
-				case 0x33:
-					switch (inst->func3)
-					{
-						case 0x00:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_add;
-									break;
-								case 0x01:
-									inst->optype = Op_mul;
-									break;
-								case 0x20:
-									inst->optype = Op_sub;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x01:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_sll;
-									break;
-								case 0x01:
-									inst->optype = Op_mulh;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x02:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_slt;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						case 0x03:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_sltu;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						case 0x04:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_xor;
-									break;
-								case 0x01:
-									inst->optype = Op_div;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						case 0x05:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_srl;
-									break;
-								case 0x20:
-									inst->optype = Op_sra;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x06:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_or;
-									break;
-								case 0x01:
-									inst->optype = Op_rem;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						case 0x07:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_and;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						default:
-							goto R_UNKNOWN;		
-					}
-					break;
-				case 0x3b:
-					switch (inst->func3)
-					{
-						case 0x00:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_addw;
-									break;
-								case 0x20:
-									inst->optype = Op_subw;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x01:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_sllw;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x05:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_srlw;
-									break;
-								case 0x20:
-									inst->optype = Op_sraw;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-					}
-					break;
-				default:
-					R_UNKNOWN:
-					vprintf("[Error] Unknown Rtype inst(opcode=0x%02x, func3=0x%02x, func7=0x%02x). [Decode]\n",
-							 inst->opcode, inst->func3, inst->func7);
-					return 0;
-			}
-			break;
-		case Itype:
-			switch (inst->opcode)
-			{
-				case 0x03:
-					switch (inst->func3)
-					{
-						case 0x00:
-							inst->optype = Op_lb;
-							break;
-						case 0x01:
-							inst->optype = Op_lh;
-							break;
-						case 0x02:
-							inst->optype = Op_lw;
-							break;
-						case 0x03:
-							inst->optype = Op_ld;
-							break;
-						case 0x04:
-							inst->optype = Op_lbu;
-							break;
-						case 0x05:
-							inst->optype = Op_lhu;
-							break;
-						case 0x06:
-							inst->optype = Op_lwu;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				case 0x13:
-					switch (inst->func3)
-					{
-						case 0x00:
-							inst->optype = Op_addi;
-							break;
-						case 0x01:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_slli;
-							else
-								goto I_UNKNOWN;
-							break;
-						case 0x02:
-							inst->optype = Op_slti;
-							break;
-						case 0x03:
-							inst->optype = Op_sltiu;
-							break;
-						case 0x04:
-							inst->optype = Op_xori;
-							break;
-						case 0x05:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_srli;
-							else if (inst->func7 == 0x10)
-								inst->optype = Op_srai;
-							else
-								goto I_UNKNOWN;
-							break;
-						case 0x06:
-							inst->optype = Op_ori;
-							break;
-						case 0x07:
-							inst->optype = Op_andi;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				case 0x1b:
-					switch (inst->func3)
-					{
-						case 0x00:
-							inst->optype = Op_addiw;
-							break;
-						case 0x01:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_slliw;
-							else
-								goto I_UNKNOWN;
-							break;
-						case 0x05:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_srliw;
-							else if (inst->func7 == 0x10)
-								inst->optype = Op_sraiw;
-							else
-								goto I_UNKNOWN;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				case 0x67:
-					switch (inst->func3)
-					{
-						case 0x00:
-							inst->optype = Op_jalr;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				case 0x73:
-					switch (inst->func3)
-					{
-						case 0x00:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_ecall;
-							else
-								goto I_UNKNOWN;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				default:
-					I_UNKNOWN:
-					vprintf("[Error] Unknown Itype inst(opcode=0x%02x, func3=0x%02x, func7=0x%02x). [Decode]\n",
-							 inst->opcode, inst->func3, inst->func7);
-					return 0;	
-			}
-			break;
-		case Stype:
-			switch (inst->func3)
-			{
-				case 0x00:
-					inst->optype = Op_sb;
-					break;
-				case 0x01:
-					inst->optype = Op_sh;
-					break;
-				case 0x02:
-					inst->optype = Op_sw;
-					break;
-				case 0x03:
-					inst->optype = Op_sd;
-					break;
-				default:
-					vprintf("[Error] Unknown func3 0x%02x for Stype inst. [Decode]\n",
-							 inst->func3);
-					return 0;
-			}
-			break;
-		case SBtype:
-			switch (inst->func3)
-			{
-				case 0x00:
-					inst->optype = Op_beq;
-					break;
-				case 0x01:
-					inst->optype = Op_bne;
-					break;
-				case 0x04:
-					inst->optype = Op_blt;
-					break;
-				case 0x05:
-					inst->optype = Op_bge;
-					break;
-				case 0x06:
-					inst->optype = Op_bltu;
-					break;
-				case 0x07:
-					inst->optype = Op_bgeu;
-					break;
-				default:
-					vprintf("[Error] Unknown func3 0x%02x for SBtype inst. [Decode]\n",
-							 inst->func3);
-					return 0;
-			}
-			break;
-		case Utype:
-			switch (inst->opcode)
-			{
-				case 0x17:
-					inst->optype = Op_auipc;
-					break;
-				case 0x37:
-					inst->optype = Op_lui;
-					break;
-				default:
-					vprintf("[Error] Unknown opcode 0x%02x for Utype inst. [Decode]\n",
-							 inst->opcode);
-					return 0;
-			}
-			break;
-		case UJtype:
-			switch (inst->opcode)
-			{
-				case 0x6f:
-					inst->optype = Op_jal;
-					break;
-				default:
-					vprintf("[Error] Unknown opcode 0x%02x for UJtype inst. [Decode]\n",
-							 inst->opcode);
-					return 0;	
-			}
-			break;
-		default:
-			ASSERT(false);
-			// never reach
+		if (!inst->Decode())
+			return 0;
+		*cached = *inst;
 	}
 
 	if (debug || verbose)
@@ -611,6 +148,8 @@ Machine::Decode()
 	// cannot get data in rs1
 	if (inst->optype == Op_jalr)
 	{
+		if (!f_reg.bubble)
+			Trace(f_reg, TraceFlush, StageF, CauseJalr);
 		F_reg.bubble = true;
 		f_reg.bubble = true;
 		dprintf("pipeline: JALR stall.\n");
@@ -618,6 +157,8 @@ Machine::Decode()
 
 	if (inst->optype == Op_ecall)
 	{
+		if (!f_reg.bubble)
+			Trace(f_reg, TraceStall, StageF, CauseEcall);
 		F_reg.stall  = true;
 		f_reg.bubble = true;
 		dprintf("pipeline: ECALL stall.\n");
@@ -642,6 +183,7 @@ Machine::Execute()
 	}
 
 	Instruction *inst = &E_reg.inst;
+	Trace(E_reg, TraceOccupy, StageE);
 	if (debug || verbose)
 	{
 		printf("[E] ");
@@ -651,6 +193,14 @@ Machine::Execute()
 	val_a = E_reg.val_e;
 	val_b = E_reg.val_c;
 
+	// sources, and rd for the write order, of loads still in flight
+	int wait = 0;
+	uint32_t regs[3] = {inst->rs1, inst->rs2, inst->rd};
+	for (int i = 0; i < 3; ++i)
+		if (regs[i] && regReady[regs[i]] - cpuCount > wait)
+			wait = regReady[regs[i]] - cpuCount;
+	memStlCount += wait;
+
 	switch (inst->optype)
 	{
 		case Op_add:
@@ -849,9 +399,12 @@ Machine::Execute()
 			if (E_reg.pred_j != val_e) // predict incorrectly
 			{
 				predictor->Update(inst->adr, val_e);
-				ctrlHzdCount++;
 				predict_pc_updated = true;
 				WriteReg(P_PCReg, val_e ? val_c : inst->adr+4);
+				if (!f_reg.bubble)
+					Trace(f_reg, TraceFlush, StageF, CauseControl);
+				if (!d_reg.bubble)
+					Trace(d_reg, TraceFlush, StageD, CauseControl);
 				F_reg.bubble = false;
 				F_reg.stall  = false;
 				f_reg.bubble = true;
@@ -897,6 +450,10 @@ Machine::Execute()
 				|| inst->rd == d_reg.inst.rs2)
 			{
 				// load-use hazard
+				if (!f_reg.bubble)
+					Trace(f_reg, TraceStall, StageF, CauseLoadUse);
+				if (!d_reg.bubble)
+					Trace(d_reg, TraceStall, StageD, CauseLoadUse);
 				F_reg.stall  = true;
 				f_reg.stall  = true;
 				d_reg.bubble = true;
@@ -926,13 +483,15 @@ Machine::Execute()
 
 	if (inst->optype == Op_ecall)
 	{
+		if (!f_reg.bubble)
+			Trace(f_reg, TraceStall, StageF, CauseEcall);
 		F_reg.stall  = true;
 		f_reg.bubble = true;
 		d_reg.bubble = true;
 		dprintf("pipeline: ECALL stall.\n");
 	}
 
-	return use_cyc;
+	return use_cyc + wait;
 }
 
 int
@@ -951,6 +510,7 @@ Machine::MemoryAccess()
 	}
 
 	Instruction *inst = &M_reg.inst;
+	Trace(M_reg, TraceOccupy, StageM);
 	if (debug || verbose)
 	{
 		printf("[M] ");
@@ -961,7 +521,7 @@ Machine::MemoryAccess()
 	switch (inst->optype)
 	{
 		case Op_lb:
-			if ((use_cyc = ReadMem(val_e, 1, &val_c)) == 0)
+			if ((use_cyc = ReadMem(val_e, 1, &val_c, AccessLoad, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
@@ -969,7 +529,7 @@ Machine::MemoryAccess()
 			val_e = (int64_t)((int8_t)val_c);
 			break;
 		case Op_lh:
-			if ((use_cyc = ReadMem(val_e, 2, &val_c)) == 0)
+			if ((use_cyc = ReadMem(val_e, 2, &val_c, AccessLoad, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
@@ -977,7 +537,7 @@ Machine::MemoryAccess()
 			val_e = (int64_t)((int16_t)val_c);
 			break;
 		case Op_lw:
-			if ((use_cyc = ReadMem(val_e, 4, &val_c)) == 0)
+			if ((use_cyc = ReadMem(val_e, 4, &val_c, AccessLoad, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
@@ -985,7 +545,7 @@ Machine::MemoryAccess()
 			val_e = (int64_t)((int32_t)val_c);
 			break;
 		case Op_ld:
-			if ((use_cyc = ReadMem(val_e, 8, &val_c)) == 0)
+			if ((use_cyc = ReadMem(val_e, 8, &val_c, AccessLoad, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
@@ -993,7 +553,7 @@ Machine::MemoryAccess()
 			val_e = (int64_t)val_c;
 			break;
 		case Op_lbu:
-			if ((use_cyc = ReadMem(val_e, 1, &val_c)) == 0)
+			if ((use_cyc = ReadMem(val_e, 1, &val_c, AccessLoad, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
@@ -1001,7 +561,7 @@ Machine::MemoryAccess()
 			val_e = (uint64_t)((uint8_t)val_c);
 			break;
 		case Op_lhu:
-			if ((use_cyc = ReadMem(val_e, 2, &val_c)) == 0)
+			if ((use_cyc = ReadMem(val_e, 2, &val_c, AccessLoad, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
@@ -1009,7 +569,7 @@ Machine::MemoryAccess()
 			val_e = (uint64_t)((uint16_t)val_c);
 			break;
 		case Op_lwu:
-			if ((use_cyc = ReadMem(val_e, 4, &val_c)) == 0)
+			if ((use_cyc = ReadMem(val_e, 4, &val_c, AccessLoad, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
@@ -1017,28 +577,28 @@ Machine::MemoryAccess()
 			val_e = (uint64_t)((uint32_t)val_c);
 			break;
 		case Op_sb:
-			if ((use_cyc = WriteMem(val_e, 1, (uint8_t)val_c)) == 0)
+			if ((use_cyc = WriteMem(val_e, 1, (uint8_t)val_c, false, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
 			}
 			break;
 		case Op_sh:
-			if ((use_cyc = WriteMem(val_e, 2, (uint16_t)val_c)) == 0)
+			if ((use_cyc = WriteMem(val_e, 2, (uint16_t)val_c, false, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
 			}
 			break;
 		case Op_sw:
-			if ((use_cyc = WriteMem(val_e, 4, (uint32_t)val_c)) == 0)
+			if ((use_cyc = WriteMem(val_e, 4, (uint32_t)val_c, false, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
 			}
 			break;
 		case Op_sd:
-			if ((use_cyc = WriteMem(val_e, 8, (uint64_t)val_c)) == 0)
+			if ((use_cyc = WriteMem(val_e, 8, (uint64_t)val_c, false, inst->adr)) == 0)
 			{
 				vprintf("--Memory access error. [MemoryAccess]\n");
 				return 0;
@@ -1050,6 +610,16 @@ Machine::MemoryAccess()
 			dprintf("No memory access.\n");
 	}
 
+	// non-blocking: the rest of a load miss overlaps the insts behind it
+	if (loadHitCyc && use_cyc > loadHitCyc && (inst->optype == Op_lb || inst->optype == Op_lh
+		|| inst->optype == Op_lw || inst->optype == Op_ld || inst->optype == Op_lbu
+		|| inst->optype == Op_lhu || inst->optype == Op_lwu))
+	{
+		if (inst->rd)
+			regReady[inst->rd] = cpuCount + use_cyc;
+		use_cyc = loadHitCyc;
+	}
+
 	dprintf("val_e = 0x%016llx  val_c = 0x%016llx\n", val_e, val_c);
 	
 	m_reg = M_reg;
@@ -1077,6 +647,8 @@ Machine::MemoryAccess()
 
 	if (inst->optype == Op_ecall)
 	{
+		if (!f_reg.bubble)
+			Trace(f_reg, TraceStall, StageF, CauseEcall);
 		F_reg.stall  = true;
 		f_reg.bubble = true;
 		d_reg.bubble = true;
@@ -1100,6 +672,7 @@ Machine::WriteBack()
 
 	instCount++;
 	Instruction *inst = &W_reg.inst;
+	Trace(W_reg, TraceRetire, StageW, inst->optype);
 	if (debug || verbose)
 	{
 		printf("[W] ");
@@ -1107,12 +680,14 @@ Machine::WriteBack()
 	}
 	int64_t val_e = W_reg.val_e, val_c = W_reg.val_c;
 	WriteReg(PCReg, inst->adr);
+	commitNext = inst->adr + 4;
 
 	switch (inst->optype)
 	{
 		case Op_jalr:
 		case Op_jal:
 			// WriteReg(PCReg, val_c);
+			commitNext = val_c;
 		case Op_add:
 		case Op_addw:
 		case Op_mul:
@@ -1166,55 +741,19 @@ Machine::WriteBack()
 		case Op_bgeu:
 			// if (val_e == 1)
 			//	WriteReg(PCReg, val_c);
+			if (val_e)
+				commitNext = val_c;
+			// counted with the branch at commit, a sample window sees both
 			totalBranch++;
+			if (W_reg.pred_j != val_e)
+				ctrlHzdCount++;
 			goto NO_WRITEBACK;
 			break;
 
 		case Op_ecall:
 			ecallStlCount++;
-			val_e = ReadReg(A0Reg);
-			val_c = ReadReg(A7Reg);
-			dprintf("Syscall: a0=0x%llx a7=0x%llx.\n", val_e, val_c);
-			switch(val_c)
-			{
-				case 0:
-					printf("%d", val_e);
-					break;
-				case 1:
-					printf("%c", val_e);
-					break;
-				case 2:
-					char chr;
-					int lim;
-					lim = 0;
-					while(ReadMem((uint64_t)val_e, 1, (void*)&chr) && chr != '\0' && (++lim) <= 100)
-					{
-						printf("%c", chr);
-						val_e += 1;
-					}
-					if (lim >= MaxStrLen)
-					{
-						vprintf("[Warning] String cut due to length exceeding (> %d).\n", MaxStrLen);
-					}
-					break;
-			  	case 3:
-				    scanf("%lld", &val_e);
-				    WriteReg(A0Reg, val_e);
-				    break;
-				case 4:
-					scanf("%c", (char*)&val_e);
-				    val_e = (int64_t)((char)val_e);
-				    WriteReg(A0Reg, val_e);
-				    break;
-				case 93:
-					printf("User program exited.\n");
-					Status();
-					exit(0);
-					break;
-				default:
-					vprintf("[Error] Unknown syscall a0=0x%llx a7=0x%llx. [WriteBack]\n", val_e, val_c);
-					return 0;
-			}
+			if (!Syscall())
+				return 0;
 			break;
 			
 		default:
@@ -1249,12 +788,92 @@ Machine::WriteBack()
 	return 1;
 }
 
+// Guest system call in a0/a7, memDirect reads strings from main memory
+// (functional mode, cache data may be stale)
+bool
+Machine::Syscall(bool memDirect)
+{
+	int64_t val_e = ReadReg(A0Reg), val_c = ReadReg(A7Reg);
+	uint64_t tmp;
+	dprintf("Syscall: a0=0x%llx a7=0x%llx.\n", val_e, val_c);
+	switch(val_c)
+	{
+		case 0:
+			if (!quiet)
+				printf("%d", val_e);
+			break;
+		case 1:
+			if (!quiet)
+				printf("%c", val_e);
+			break;
+		case 2:
+			char chr;
+			int lim;
+			lim = 0;
+			for ( ; ; val_e++)
+			{
+				if (memDirect)
+				{
+					if (!FuncMem((uint64_t)val_e, 1, 1, &tmp, false))
+						break;
+					chr = tmp;
+				}
+				else if (!ReadMem((uint64_t)val_e, 1, (void*)&chr))
+					break;
+				if (chr == '\0' || (++lim) > 100)
+					break;
+				if (!quiet)
+					printf("%c", chr);
+			}
+			if (lim >= MaxStrLen)
+			{
+				vprintf("[Warning] String cut due to length exceeding (> %d).\n", MaxStrLen);
+			}
+			break;
+	  	case 3:
+		    scanf("%lld", &val_e);
+		    WriteReg(A0Reg, val_e);
+		    break;
+		case 4:
+			scanf("%c", (char*)&val_e);
+		    val_e = (int64_t)((char)val_e);
+		    WriteReg(A0Reg, val_e);
+		    break;
+		case 5:
+			ckptPending = true;
+			break;
+		case SysBrk:
+			WriteReg(A0Reg, Brk(val_e));
+			break;
+		case SysMmap:
+			// only anonymous mappings, the address hint is ignored
+			if ((int64_t)ReadReg(A4Reg) != -1)
+				WriteReg(A0Reg, -SysENOMEM);
+			else
+				WriteReg(A0Reg, Mmap(ReadReg(A1Reg)));
+			break;
+		case SysMunmap:
+			WriteReg(A0Reg, Munmap(val_e, ReadReg(A1Reg)));
+			break;
+		case 93:
+			if (!quiet)
+				printf("User program exited.\n");
+			halted = true;
+			break;
+		default:
+			vprintf("[Error] Unknown syscall a0=0x%llx a7=0x%llx. [Syscall]\n", val_e, val_c);
+			return false;
+	}
+	return true;
+}
+
 void
 Machine::UpdatePipeline()
 {
 	// update pipeline registers
 	if (!F_reg.stall && !predict_pc_updated)
 		WriteReg(P_PCReg, f_pred_pc);
+	fetchRetry = F_reg.stall;
 	F_reg.stall = false;
 
 	if (!f_reg.stall)
@@ -1266,6 +885,12 @@ Machine::UpdatePipeline()
 	W_reg = m_reg;
 }
 
+bool
+Instruction::Decode()
+{
+	return DecodeInst(*this);
+}
+
 void
 Instruction::PrintInst()
 {
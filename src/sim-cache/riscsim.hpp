@@ -3,6 +3,7 @@
 
 #define OpNum		54
 #define MaxStrLen	1024	
+#define DecodeCacheSize	4096	// entries, power of 2
 
 enum InstType 
 {
@@ -41,6 +42,7 @@ class Instruction
     InstType type;
     OpType optype;
 
+    bool Decode();
     void PrintInst();
 };
 
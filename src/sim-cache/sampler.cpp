@@ -0,0 +1,124 @@
+#include "machine.hpp"
+#include "sampler.hpp"
+#include "utils.hpp"
+#include <math.h>
+#include <stdio.h>
+
+void
+SampleStat::Add(double x)
+{
+	n++;
+	double delta = x - mean;
+	mean += delta / n;
+	m2 += delta * (x - mean);
+}
+
+double
+SampleStat::StdDev()
+{
+	return n > 1 ? sqrt(m2 / (n - 1)) : 0;
+}
+
+double
+SampleStat::HalfWidth()
+{
+	return n > 1 ? SampleZ95 * StdDev() / sqrt((double)n) : 0;
+}
+
+Sampler::Sampler(Machine *machine, uint64_t period, uint64_t size, uint64_t warmup)
+: machine(machine), period(period), size(size), warmup(warmup)
+{
+}
+
+void
+Sampler::Run()
+{
+	Timer timer;
+	uint64_t ff = period - size - warmup;
+
+	while (!machine->halted)
+	{
+		machine->FastForward(ff, true);
+		if (machine->halted)
+			break;
+
+		if (!Measure())
+			break;
+
+		// back to functional mode, memory must hold the newest data
+		machine->Drain();
+		machine->FlushCaches();
+	}
+	machine->runTime += timer.Finish();
+}
+
+// Detailed warm-up and one measured window, false if the program exited
+// before the window was complete
+bool
+Sampler::Measure()
+{
+	Machine *m = machine;
+	std::vector<Cache*> &level = m->caches;
+	int acc[CacheNodeMax], miss[CacheNodeMax];
+
+	m->F_reg.bubble = false;
+	uint64_t target = m->instCount + warmup;
+	while ((uint64_t)m->instCount < target)
+		if (!m->Cycle())
+			return false;
+
+	int cyc = m->cycCount, cpu = m->cpuCount, inst = m->instCount;
+	int branch = m->totalBranch, mispred = m->ctrlHzdCount;
+	for (size_t i = 0; i < level.size(); ++i)
+	{
+		acc[i] = level[i]->Accesses();
+		miss[i] = level[i]->Misses();
+	}
+
+	target += size;
+	while ((uint64_t)m->instCount < target)
+		if (!m->Cycle())
+			return false;
+
+	inst = m->instCount - inst;
+	cpi.Add((double)(m->cycCount - cyc) / inst);
+	cpuCpi.Add((double)(m->cpuCount - cpu) / inst);
+	branch = m->totalBranch - branch;
+	if (branch)
+		branchAcc.Add((double)(branch - (m->ctrlHzdCount - mispred)) / branch);
+	for (size_t i = 0; i < level.size(); ++i)
+		if (level[i]->Accesses() > acc[i])
+			missRate[i].Add((double)(level[i]->Misses() - miss[i]) / (level[i]->Accesses() - acc[i]));
+
+	dprintf("sampler: sample %d at inst %llu, CpI %.3lf.\n", cpi.n, m->ffCount + m->instCount, cpi.mean);
+	return true;
+}
+
+void
+Sampler::Print(FILE *fout)
+{
+	if (fout == NULL)
+		fout = stdout;
+
+	fprintf(fout, "\n--------------- Sampling ---------------\n");
+	fprintf(fout, "- Period:            %llu  (warm-up %llu, measure %llu)\n", period, warmup, size);
+	fprintf(fout, "- Samples:           %d\n", cpi.n);
+	if (cpi.n == 0)
+	{
+		fprintf(fout,   "----------------------------------------\n");
+		return;
+	}
+	fprintf(fout, "- Pipeline Cyc CpI:  %.4lf +- %.4lf\n", cpi.Mean(), cpi.HalfWidth());
+	fprintf(fout, "- CPU Cyc CpI:       %.4lf +- %.4lf\n", cpuCpi.Mean(), cpuCpi.HalfWidth());
+	if (branchAcc.n)
+		fprintf(fout, "- Branch Pred Acc:   %.2lf%% +- %.2lf%%\n", branchAcc.Mean()*100, branchAcc.HalfWidth()*100);
+	for (size_t i = 0; i < machine->layout.size(); ++i)
+		if (missRate[i].n)
+		{
+			std::string label = machine->layout[i].label + " Miss Rate:";
+			fprintf(fout, "- %-19s%.2lf%% +- %.2lf%%\n", label.c_str(), missRate[i].Mean()*100,
+					missRate[i].HalfWidth()*100);
+		}
+	fprintf(fout, "  (95%% confidence intervals)\n");
+	fprintf(fout,   "----------------------------------------\n");
+}
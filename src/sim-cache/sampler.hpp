@@ -0,0 +1,51 @@
+#ifndef SAMPLER_HEADER
+#define SAMPLER_HEADER
+
+#include "utils.hpp"
+#include "config.hpp"
+#include <stdint.h>
+#include <stdio.h>
+
+#define SampleZ95           1.96    // normal quantile for a 95% interval
+
+class Machine;
+
+// Running mean and variance of one per-sample metric (Welford)
+class SampleStat
+{
+public:
+	SampleStat() : n(0), mean(0), m2(0) {}
+
+	void Add(double x);
+	double Mean() { return mean; }
+	double StdDev();
+	double HalfWidth(); // 95% confidence half-width of the mean
+
+	int n;
+	double mean, m2;
+};
+
+// Periodic sampling: each period fast-forwards functionally with warm
+// caches and predictor, runs warmup detailed insts unmeasured, measures
+// size detailed insts, then drains the pipeline.
+class Sampler
+{
+public:
+	Sampler(Machine *machine, uint64_t period, uint64_t size, uint64_t warmup);
+
+	void Run();
+	void Print(FILE *fout = NULL);
+
+private:
+	bool Measure();
+
+	Machine *machine;
+	uint64_t period, size, warmup;
+
+	SampleStat cpi, cpuCpi, branchAcc;
+	SampleStat missRate[CacheNodeMax];    // per cache, as Machine::caches
+
+	DISALLOW_COPY_AND_ASSIGN(Sampler);
+};
+
+#endif
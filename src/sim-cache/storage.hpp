@@ -15,6 +15,37 @@ typedef struct StorageStats_
 	int prefetch_num; // Prefetch
 } StorageStats;
 
+enum MemAccess
+{
+	AccessFetch,        // instruction fetch
+	AccessLoad,
+	AccessStore,
+	AccessWriteback,    // dirty line leaving a cache
+	AccessPrefetch,     // line fill issued by a prefetcher, or its writeback
+	AccessVictim        // clean line evicted into an exclusive level below
+};
+
+// One request down the hierarchy. A cache passes the request on with
+// its own addr, bytes and read for fills and writebacks, the rest tells
+// the lower levels who asked.
+struct MemRequest
+{
+	uint64_t addr;
+	int bytes;
+	int read;           // 0|1 for write|read
+	MemAccess type;
+	uint64_t pc;        // instruction making the access, 0 if none
+	int core;           // always 0, single core
+	uint64_t time;      // cycle the access was issued
+};
+
+inline MemRequest
+MakeRequest(uint64_t addr, int bytes, int read, MemAccess type, uint64_t pc = 0, uint64_t time = 0)
+{
+	MemRequest req = {addr, bytes, read, type, pc, 0, time};
+	return req;
+}
+
 // Storage basic config
 typedef struct StorageLatency_
 {
@@ -35,15 +66,16 @@ public:
 	void GetLatency(StorageLatency &sl) { sl = latency_; }
 
 	// Main access process
-	// [in]  addr: access address
-	// [in]  bytes: target number of bytes
-	// [in]  read: 0|1 for write|read
+	// [in]  req: address, size, direction and origin of the access,
+	//            prefetches are not counted as accesses
 	// [i|o] content: in|out data
 	// [out] hit: 0|1 for miss|hit
 	// [out] time: total access time
-	virtual void HandleRequest(uint64_t addr, int bytes, int read,
-								uint8_t *content, int &hit, int &time,
-								bool prefetching = false) = 0;
+	virtual void HandleRequest(const MemRequest &req,
+								uint8_t *content, int &hit, int &time) = 0;
+
+	// Tag-only update while fast-forwarding, no data and no timing
+	virtual void Warm(uint64_t addr, int read) {}
 
 protected:
 	StorageStats stats_;
@@ -0,0 +1,340 @@
+#include "sweep.hpp"
+#include "machine.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <thread>
+
+Sweep::Sweep(const Config &base, int cacheLevel, PRED_TYPE pred)
+: ffInst(0), detailInst(0), memPages(PhysicalPageNum), warm(false),
+  base(base), cacheLevel(cacheLevel), pred(pred), runTrace(false)
+{
+	// a bad graph is reported again by StorageInit of the first job
+	int inst, data;
+	this->base.Hierarchy(cacheLevel, layout, inst, data);
+}
+
+bool
+Sweep::AddParam(const char *spec)
+{
+	const char *eq = strchr(spec, '=');
+	if (eq == NULL)
+		return false;
+
+	SweepParam p;
+	p.name.assign(spec, eq - spec);
+	p.id = p.name == "PRED" ? SweepPred : base.KeyId(p.name.c_str());
+	if (p.id == -1 || p.id == ICACHE || p.id == DCACHE
+		|| (p.id >= ConfigU32Num && (p.id - ConfigU32Num) % CacheKeyNum == C_LOWER))
+		return false;
+
+	const char *s = eq + 1;
+	while (*s)
+	{
+		char *end;
+		unsigned long v = strtoul(s, &end, 0);
+		if (end == s || (*end && *end != ','))
+			return false;
+		// values the simulator would reject with a panic
+		if (p.id == SweepPred && v >= PredTypeNum)
+			return false;
+		if (p.name.size() > 6 && p.name.compare(p.name.size() - 6, 6, "METHOD") == 0
+			&& v >= ReplaceMethodNum)
+			return false;
+		if (p.name.size() > 7 && p.name.compare(p.name.size() - 7, 7, "PF_TYPE") == 0
+			&& v >= PrefetchTypeNum)
+			return false;
+		if (p.name.size() > 4 && p.name.compare(p.name.size() - 4, 4, "INCL") == 0
+			&& v >= InclusionNum)
+			return false;
+		if (p.name.size() > 4 && p.name.compare(p.name.size() - 4, 4, "DEAD") == 0
+			&& v >= DeadBlockNum)
+			return false;
+		p.values.push_back(v);
+		s = *end ? end + 1 : end;
+	}
+	if (p.values.empty())
+		return false;
+	params.push_back(p);
+	return true;
+}
+
+bool
+Sweep::LoadElf(const char *name)
+{
+	runTrace = false;
+	return image.Load(name);
+}
+
+bool
+Sweep::LoadTrace(const char *name)
+{
+	FILE *fin = fopen(name, "r");
+	if (fin == NULL)
+		return false;
+
+	char buf[100], op[10];
+	TraceAccess a;
+	while (fgets(buf, 100, fin))
+	{
+		if (sscanf(buf, "%9s %llx", op, (unsigned long long*)&a.addr) != 2
+			|| (op[0] != 'r' && op[0] != 'w'))
+		{
+			fclose(fin);
+			return false;
+		}
+		a.read = op[0] == 'r';
+		accesses.push_back(a);
+	}
+	fclose(fin);
+	runTrace = true;
+	return true;
+}
+
+// Cross product in row-major order, the last parameter varies fastest
+void
+Sweep::Run(int threads)
+{
+	size_t total = 1;
+	for (size_t i = 0; i < params.size(); ++i)
+		total *= params[i].values.size();
+
+	results.assign(total, SweepResult());
+	for (size_t j = 0; j < total; ++j)
+	{
+		size_t rest = j;
+		results[j].values.resize(params.size());
+		for (int i = params.size() - 1; i >= 0; --i)
+		{
+			results[j].values[i] = params[i].values[rest % params[i].values.size()];
+			rest /= params[i].values.size();
+		}
+	}
+
+	if (threads < 1)
+		threads = 1;
+	if ((size_t)threads > total)
+		threads = total;
+	queues.clear();
+	for (int w = 0; w < threads; ++w)
+		queues.emplace_back();
+	for (size_t j = 0; j < total; ++j)
+		queues[j % threads].jobs.push_back(j);
+
+	std::vector<std::thread> pool;
+	for (int w = 0; w < threads; ++w)
+		pool.push_back(std::thread(&Sweep::Worker, this, w));
+	for (int w = 0; w < threads; ++w)
+		pool[w].join();
+}
+
+bool
+Sweep::Next(int w, int &job)
+{
+	{
+		std::lock_guard<std::mutex> g(queues[w].lock);
+		if (!queues[w].jobs.empty())
+		{
+			job = queues[w].jobs.back();
+			queues[w].jobs.pop_back();
+			return true;
+		}
+	}
+	// no job is ever added, so finding every queue empty means done
+	for (size_t k = 1; k < queues.size(); ++k)
+	{
+		JobQueue &q = queues[(w + k) % queues.size()];
+		std::lock_guard<std::mutex> g(q.lock);
+		if (!q.jobs.empty())
+		{
+			job = q.jobs.front();
+			q.jobs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+Sweep::Worker(int w)
+{
+	int job;
+	while (Next(w, job))
+		RunJob(job);
+}
+
+bool
+Sweep::ValidGeometry(Config &c)
+{
+	for (size_t l = 0; l < layout.size(); ++l)
+	{
+		unsigned size = c.GetConfig((layout[l].prefix + "SIZE").c_str());
+		unsigned assoc = c.GetConfig((layout[l].prefix + "ASSOC").c_str());
+		unsigned line = c.GetConfig((layout[l].prefix + "BSIZE").c_str());
+		if (assoc == 0 || line == 0 || size / assoc / line == 0)
+			return false;
+		// StorageInit refuses upper lines larger than an inclusive or exclusive level's
+		int lo = layout[l].lower;
+		if (lo >= 0 && c.GetConfig((layout[lo].prefix + "INCL").c_str()) >= INCLUSIVE
+			&& line > c.GetConfig((layout[lo].prefix + "BSIZE").c_str()))
+			return false;
+	}
+	return true;
+}
+
+void
+Sweep::RunJob(int job)
+{
+	SweepResult &r = results[job];
+	Config cfg = base;
+	PRED_TYPE p = pred;
+	for (size_t i = 0; i < params.size(); ++i)
+	{
+		if (params[i].id == SweepPred)
+			p = (PRED_TYPE)r.values[i];
+		else
+			cfg.Value(params[i].id) = r.values[i];
+	}
+
+	r.valid = ValidGeometry(cfg);
+	r.insts = r.cycles = r.time = 0;
+	r.branches = r.mispredicts = 0;
+	r.access.assign(layout.size(), 0);
+	r.miss.assign(layout.size(), 0);
+	if (!r.valid)
+		return;
+
+	Machine *m = new Machine(p);
+	m->cfg = cfg;
+	m->quiet = true;
+	m->physPages = memPages;
+	m->StorageInit(cacheLevel, runTrace);
+
+	if (runTrace)
+	{
+		int hit, time;
+		for (size_t i = 0; i < accesses.size(); ++i)
+		{
+			MemAccess type = accesses[i].read ? AccessLoad : AccessStore;
+			m->topStorage->HandleRequest(MakeRequest(accesses[i].addr, 1, accesses[i].read, type, 0, r.time),
+										NULL, hit, time);
+			r.time += time;
+		}
+	}
+	else if ((r.valid = image.Apply(m)))
+	{
+		if (ffInst)
+		{
+			m->FastForward(ffInst, warm);
+			m->ResetStats();
+		}
+		m->Run(detailInst);
+		r.insts = m->instCount;
+		r.cycles = m->cycCount;
+		r.branches = m->totalBranch;
+		r.mispredicts = m->ctrlHzdCount;
+	}
+
+	for (size_t l = 0; l < m->caches.size(); ++l)
+	{
+		r.access[l] = m->caches[l]->Accesses();
+		r.miss[l] = m->caches[l]->Misses();
+	}
+	delete m;
+}
+
+// Label in lower case, l1d_access, ...
+std::string
+Sweep::Column(int l)
+{
+	std::string s = layout[l].label;
+	for (size_t i = 0; i < s.size(); ++i)
+		s[i] = tolower(s[i]);
+	return s;
+}
+
+bool
+Sweep::Write(const char *name)
+{
+	FILE *fout = strcmp(name, "-") == 0 ? stdout : fopen(name, "w");
+	if (fout == NULL)
+		return false;
+	size_t len = strlen(name);
+	bool json = len > 5 && strcmp(name + len - 5, ".json") == 0;
+
+	if (json)
+		fprintf(fout, "[\n");
+	else
+	{
+		for (size_t i = 0; i < params.size(); ++i)
+			fprintf(fout, "%s,", params[i].name.c_str());
+		fprintf(fout, "valid,%s", runTrace ? "accesses,amat" : "insts,cycles,cpi,branch_acc");
+		for (size_t l = 0; l < layout.size(); ++l)
+			fprintf(fout, ",%s_access,%s_miss_rate", Column(l).c_str(), Column(l).c_str());
+		fprintf(fout, "\n");
+	}
+
+	for (size_t j = 0; j < results.size(); ++j)
+	{
+		SweepResult &r = results[j];
+		if (json)
+		{
+			fprintf(fout, "  {");
+			for (size_t i = 0; i < params.size(); ++i)
+				fprintf(fout, "\"%s\": %u, ", params[i].name.c_str(), r.values[i]);
+			fprintf(fout, "\"valid\": %s", r.valid ? "true" : "false");
+		}
+		else
+		{
+			for (size_t i = 0; i < params.size(); ++i)
+				fprintf(fout, "%u,", r.values[i]);
+			fprintf(fout, "%d", r.valid);
+		}
+
+		if (r.valid)
+		{
+			const char *fmt[2] = {",%s%llu", ", \"%s\": %llu"};
+			const char *ffmt[2] = {",%s%.6lf", ", \"%s\": %.6lf"};
+			if (runTrace)
+			{
+				fprintf(fout, fmt[json], json ? "accesses" : "", (unsigned long long)accesses.size());
+				fprintf(fout, ffmt[json], json ? "amat" : "",
+						accesses.empty() ? 0 : (double)r.time / accesses.size());
+			}
+			else
+			{
+				fprintf(fout, fmt[json], json ? "insts" : "", (unsigned long long)r.insts);
+				fprintf(fout, fmt[json], json ? "cycles" : "", (unsigned long long)r.cycles);
+				fprintf(fout, ffmt[json], json ? "cpi" : "", r.insts ? (double)r.cycles / r.insts : 0);
+				fprintf(fout, ffmt[json], json ? "branch_acc" : "",
+						r.branches ? (double)(r.branches - r.mispredicts) / r.branches : 0);
+			}
+			for (size_t l = 0; l < layout.size(); ++l)
+			{
+				char key[2][20];
+				snprintf(key[0], 20, "%s_access", Column(l).c_str());
+				snprintf(key[1], 20, "%s_miss_rate", Column(l).c_str());
+				fprintf(fout, fmt[json], json ? key[0] : "", (unsigned long long)r.access[l]);
+				fprintf(fout, ffmt[json], json ? key[1] : "",
+						r.access[l] ? (double)r.miss[l] / r.access[l] : 0);
+			}
+		}
+		else if (!json)
+		{
+			int cols = (runTrace ? 2 : 4) + 2 * layout.size();
+			for (int k = 0; k < cols; ++k)
+				fprintf(fout, ",");
+		}
+
+		if (json)
+			fprintf(fout, "}%s\n", j + 1 < results.size() ? "," : "");
+		else
+			fprintf(fout, "\n");
+	}
+	if (json)
+		fprintf(fout, "]\n");
+
+	if (fout != stdout)
+		fclose(fout);
+	return true;
+}
@@ -0,0 +1,92 @@
+#ifndef SWEEP_HEADER
+#define SWEEP_HEADER
+
+#include "image.hpp"
+#include "config.hpp"
+#include "predictor.hpp"
+#include "utils.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+#define SweepPred           -1          // SweepParam::id of the predictor type
+
+// NAME=v1,v2,... where NAME is a cfg key (L1C_SIZE, C2_ASSOC, ...) or PRED,
+// the keys that shape the cache graph are fixed
+class SweepParam
+{
+public:
+	std::string name;
+	int id;                     // Config::KeyId, or SweepPred
+	std::vector<unsigned> values;
+};
+
+class SweepResult
+{
+public:
+	std::vector<unsigned> values;   // one per parameter
+	bool valid;                     // cache geometry could be built
+	uint64_t insts, cycles;         // ELF runs
+	int branches, mispredicts;
+	uint64_t time;                  // trace runs: total access time
+	std::vector<int> access, miss;  // per cache, as the layout
+};
+
+class TraceAccess
+{
+public:
+	uint64_t addr;
+	int read;
+};
+
+// Runs every point of the cross product of the parameters, each on its
+// own Machine. The base cfg and the ELF image or trace are loaded once
+// and only read by the workers.
+class Sweep
+{
+public:
+	Sweep(const Config &base, int cacheLevel, PRED_TYPE pred);
+
+	bool AddParam(const char *spec);
+	bool LoadElf(const char *name);
+	bool LoadTrace(const char *name);
+	void Run(int threads);
+	bool Write(const char *name);   // CSV, JSON if name ends in .json, "-" for stdout
+
+	uint64_t ffInst, detailInst, memPages;
+	bool warm;
+
+private:
+	// Work stealing: each worker pops from the back of its own queue and
+	// steals from the front of the others once it runs dry
+	class JobQueue
+	{
+	public:
+		std::mutex lock;
+		std::deque<int> jobs;
+	};
+
+	bool Next(int w, int &job);
+	void Worker(int w);
+	void RunJob(int job);
+	bool ValidGeometry(Config &cfg);
+	std::string Column(int l);
+
+	Config base;
+	int cacheLevel;
+	std::vector<CacheNode> layout;  // of the base cfg
+	PRED_TYPE pred;
+	bool runTrace;
+	ElfImage image;
+	std::vector<TraceAccess> accesses;
+	std::vector<SweepParam> params;
+	std::vector<SweepResult> results;
+	std::deque<JobQueue> queues;
+
+	DISALLOW_COPY_AND_ASSIGN(Sweep);
+};
+
+#endif
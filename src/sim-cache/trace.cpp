@@ -0,0 +1,80 @@
+#include "trace.hpp"
+#include "riscsim.hpp"
+#include <string.h>
+#include <unistd.h>
+
+TraceRecorder::TraceRecorder()
+: records(0), out(NULL), head(0), tail(0), tailCache(0), stop(false)
+{
+	ring = new TraceRecord[TraceRingSize];
+}
+
+TraceRecorder::~TraceRecorder()
+{
+	Close();
+	delete[] ring;
+}
+
+bool
+TraceRecorder::Open(const char *name)
+{
+	if ((out = fopen(name, "wb")) == NULL)
+	{
+		vprintf("[Error] Can not open trace file %s. [TraceRecorder]\n", name);
+		return false;
+	}
+
+	uint64_t magic = TraceMagic;
+	uint32_t version = TraceVersion, size = sizeof(TraceRecord), ops = OpNum;
+	fwrite(&magic, sizeof magic, 1, out);
+	fwrite(&version, sizeof version, 1, out);
+	fwrite(&size, sizeof size, 1, out);
+	fwrite(&ops, sizeof ops, 1, out);
+	for (int i = 0; i < OpNum; ++i)
+		fwrite(op_str[i], strlen(op_str[i]) + 1, 1, out);
+
+	stop = false;
+	writer = std::thread(&TraceRecorder::Writer, this);
+	return true;
+}
+
+// Flush everything recorded so far and stop the writer
+void
+TraceRecorder::Close()
+{
+	if (out == NULL)
+		return;
+	stop.store(true, std::memory_order_release);
+	writer.join();
+	records = head.load();
+	fclose(out);
+	out = NULL;
+}
+
+void
+TraceRecorder::Writer()
+{
+	while (true)
+	{
+		// read stop first so records published before it are not lost
+		bool last = stop.load(std::memory_order_acquire);
+		uint64_t h = head.load(std::memory_order_acquire);
+		uint64_t t = tail.load(std::memory_order_relaxed);
+
+		if (h == t)
+		{
+			if (last)
+				break;
+			usleep(100);
+			continue;
+		}
+
+		// contiguous part up to the end of the ring, the rest next round
+		uint64_t start = t & (TraceRingSize - 1);
+		uint64_t num = h - t;
+		if (num > TraceRingSize - start)
+			num = TraceRingSize - start;
+		fwrite(ring + start, sizeof(TraceRecord), num, out);
+		tail.store(t + num, std::memory_order_release);
+	}
+}
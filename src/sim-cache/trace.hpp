@@ -0,0 +1,93 @@
+#ifndef TRACE_HEADER
+#define TRACE_HEADER
+
+#include "utils.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+
+#define TraceMagic          0x3145434152545652ull   // "RVTRACE1"
+#define TraceVersion        1
+#define TraceRingSize       (1 << 16)   // records, power of 2
+
+enum TraceStage
+{
+	StageF, StageD, StageE, StageM, StageW
+};
+
+enum TraceKind
+{
+	TraceOccupy,    // inst is in stage this cycle
+	TraceRetire,    // inst committed in writeback, arg = optype
+	TraceStall,     // inst held in stage, arg = TraceCause
+	TraceFlush      // inst squashed, arg = TraceCause
+};
+
+enum TraceCause
+{
+	CauseLoadUse, CauseControl, CauseJalr, CauseEcall
+};
+
+// One pipeline event, fixed size so the decoder can mmap or fread it
+struct TraceRecord
+{
+	uint64_t pc;
+	uint32_t cycle;
+	uint32_t seq;       // fetch sequence number, same for a re-fetched inst
+	uint32_t value;     // inst word
+	uint8_t kind, stage;
+	uint16_t arg;
+};
+
+// File layout: magic, version, record size, op name count and names
+// (NUL terminated), then TraceRecords until EOF
+
+// Binary event recorder. The simulator thread appends to a single
+// producer / single consumer ring, a writer thread drains it to disk.
+class TraceRecorder
+{
+public:
+	TraceRecorder();
+	~TraceRecorder();
+
+	bool Open(const char *name);
+	void Close();
+
+	void Record(uint32_t cycle, uint32_t seq, uint64_t pc, uint32_t value,
+				int kind, int stage, int arg = 0)
+	{
+		uint64_t h = head.load(std::memory_order_relaxed);
+		if (h - tailCache >= TraceRingSize)
+		{
+			// full, wait for the writer
+			while (h - (tailCache = tail.load(std::memory_order_acquire)) >= TraceRingSize)
+				std::this_thread::yield();
+		}
+		TraceRecord &r = ring[h & (TraceRingSize - 1)];
+		r.pc = pc;
+		r.cycle = cycle;
+		r.seq = seq;
+		r.value = value;
+		r.kind = kind;
+		r.stage = stage;
+		r.arg = arg;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	uint64_t records;
+
+private:
+	void Writer();
+
+	FILE *out;
+	TraceRecord *ring;
+	std::atomic<uint64_t> head, tail;
+	uint64_t tailCache;     // producer's view of tail
+	std::atomic<bool> stop;
+	std::thread writer;
+
+	DISALLOW_COPY_AND_ASSIGN(TraceRecorder);
+};
+
+#endif
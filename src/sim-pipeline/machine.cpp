@@ -76,6 +76,7 @@ Machine::Machine(PRED_TYPE mode)
 	for (int i = 0; i < PhysicalPageNum; ++i)
 		freePage.push(i);
 	pte = new PageTableEntry[PhysicalPageNum];
+	TlbFlush();
 
 	predictor = new Predictor(mode);
 
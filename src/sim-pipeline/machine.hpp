@@ -55,6 +55,7 @@ public:
     bool ReadMem(uint64_t addr, int size, void *value);
     bool WriteMem(uint64_t addr, int size, uint64_t value);
     bool Translate(uint64_t v_addr, uint64_t *p_addr, int size);
+    void TlbFlush();
     void PrintMem(FILE *fout = NULL, bool no_data = false);
     void PrintPageTable(FILE *fout = NULL);
 
@@ -76,6 +77,7 @@ public:
     uint8_t *mem;
     std::map<uint64_t, PageTableEntry*> pageTable;
     PageTableEntry *pte;
+    TlbEntry tlb[TlbSize];
     std::priority_queue<uint64_t> freePage;
     PipelineRegister F_reg, D_reg, E_reg, M_reg, W_reg;
     PipelineRegister f_reg, d_reg, e_reg, m_reg;
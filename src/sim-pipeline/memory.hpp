@@ -12,4 +12,15 @@ public:
 	bool valid;
 };
 
+#define TlbSize             64      // soft TLB entries, power of 2
+
+// Direct-mapped cache of page table lookups, vpn is ~0 when empty
+class TlbEntry
+{
+public:
+	uint64_t vpn;
+	uint64_t ppn;
+	uint8_t *host;      // the physical page in simulator memory
+};
+
 #endif
@@ -0,0 +1,52 @@
+#include "bbv.hpp"
+#include "utils.hpp"
+#include <stdio.h>
+
+BbvProfiler::BbvProfiler(FILE *out, uint64_t interval)
+: intervals(0), out(out), interval(interval), total(0)
+{
+	counts.push_back(0); // id 0 unused
+}
+
+BbvProfiler::~BbvProfiler()
+{
+	fclose(out);
+}
+
+int
+BbvProfiler::BlockId(uint64_t adr)
+{
+	std::unordered_map<uint64_t, int>::iterator it = ids.find(adr);
+	if (it != ids.end())
+		return it->second;
+
+	int id = counts.size();
+	ids[adr] = id;
+	counts.push_back(0);
+	return id;
+}
+
+void
+BbvProfiler::Flush()
+{
+	fprintf(out, "T");
+	for (size_t i = 0; i < touched.size(); ++i)
+	{
+		fprintf(out, ":%d:%llu ", touched[i], counts[touched[i]]);
+		counts[touched[i]] = 0;
+	}
+	fprintf(out, "\n");
+	touched.clear();
+	total = 0;
+	intervals++;
+}
+
+// Last, partial interval
+void
+BbvProfiler::Finish()
+{
+	if (total)
+		Flush();
+	fflush(out);
+	dprintf("bbv: %d intervals, %d blocks.\n", intervals, (int)ids.size());
+}
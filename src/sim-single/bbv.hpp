@@ -0,0 +1,47 @@
+#ifndef BBV_HEADER
+#define BBV_HEADER
+
+#include "utils.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <unordered_map>
+
+#define BbvDefaultInterval  10000000    // insts per interval
+
+// Basic-block vector profile in SimPoint .bb format: one line per
+// interval, "T" followed by ":id:count" for every block executed, where
+// count is the number of insts run in that block
+class BbvProfiler
+{
+public:
+	BbvProfiler(FILE *out, uint64_t interval);
+	~BbvProfiler();
+
+	int BlockId(uint64_t adr);
+	void Count(int id, int insts)
+	{
+		if (counts[id] == 0)
+			touched.push_back(id);
+		counts[id] += insts;
+		total += insts;
+		if (total >= interval)
+			Flush();
+	}
+	void Finish();
+
+	int intervals;
+
+private:
+	void Flush();
+
+	FILE *out;
+	uint64_t interval, total;
+	std::unordered_map<uint64_t, int> ids;  // block start -> id, from 1
+	std::vector<uint64_t> counts;
+	std::vector<int> touched;
+
+	DISALLOW_COPY_AND_ASSIGN(BbvProfiler);
+};
+
+#endif
@@ -0,0 +1,373 @@
+#include "machine.hpp"
+#include "jit.hpp"
+#include "utils.hpp"
+#include <stdio.h>
+#include <string.h>
+
+// Host pointer for an aligned guest access, NULL sends the access to the
+// slow path (misaligned, unmapped, or a store into translated code)
+inline uint8_t *
+Machine::FastHost(uint64_t addr, int size, bool write)
+{
+	if (addr & (size - 1))
+		return NULL;
+
+	uint64_t vpn = addr / PageSize;
+	FastHostEntry *entry = (write ? fastWrite : fastRead) + (vpn & (FastHostNum - 1));
+	if (entry->vpn != vpn)
+	{
+		uint64_t p_addr;
+		if (write && codePage.count(vpn))
+			return NULL;
+		if (!Translate(vpn * PageSize, &p_addr, 1))
+			return NULL;
+		entry->vpn = vpn;
+		entry->host = tlb[vpn & (TlbSize - 1)].host;
+	}
+	return entry->host + addr % PageSize;
+}
+
+FastBlock *
+Machine::FastTranslate(uint64_t adr, void **label)
+{
+	FastBlock *block = new FastBlock;
+	block->adr = adr;
+	block->ops = new FastOp[FastBlockMaxLen + 1];
+	block->succ[0] = block->succ[1] = NULL;
+	block->execCount = 0;
+	block->native = NULL;
+	block->bbvId = bbv != NULL ? bbv->BlockId(adr) : 0;
+
+	// stores into this page must now leave the fast path
+	uint64_t vpn = adr / PageSize;
+	codePage[vpn].push_back(block);
+	if (fastWrite[vpn & (FastHostNum - 1)].vpn == vpn)
+		fastWrite[vpn & (FastHostNum - 1)].vpn = -1;
+
+	Instruction inst;
+	uint64_t pc = adr;
+	int n = 0, term = FastOpEnd;
+	while (n < FastBlockMaxLen)
+	{
+		inst.adr = pc;
+		if (!ReadMem(pc, 4, (void*)&inst.value) || !inst.Decode()
+			|| inst.optype == Op_ecall)
+		{
+			term = FastOpSlow;
+			break;
+		}
+
+		FastOp *op = block->ops + n;
+		op->handler = label[inst.optype];
+		op->optype = inst.optype;
+		op->rd = inst.rd ? inst.rd : FastScratchReg;
+		op->rs1 = inst.rs1;
+		op->rs2 = inst.rs2;
+		op->imm = inst.imm;
+		op->adr = pc;
+		n++;
+		pc += 4;
+
+		if (inst.type == SBtype || inst.optype == Op_jal || inst.optype == Op_jalr)
+			break;
+		if (pc % PageSize == 0)
+			break;
+	}
+
+	block->num = n;
+	block->ops[n].handler = label[term];
+	block->ops[n].optype = term;
+	block->ops[n].adr = pc;
+	dprintf("fast: block 0x%llx, %d insts.\n", adr, n);
+
+	return block;
+}
+
+// Load/store helper for compiled blocks
+static uint8_t *
+JitHost(Machine *machine, uint64_t addr, int size, int write)
+{
+	return machine->FastHost(addr, size, write);
+}
+
+bool
+Machine::JitInit()
+{
+	jit = new Jit(JitHost);
+	if (!jit->Available())
+	{
+		vprintf("[Error] JIT not supported on this host [JitInit]\n");
+		delete jit;
+		jit = NULL;
+		return false;
+	}
+	return true;
+}
+
+// Compile a hot block. A full code buffer is emptied first, every block
+// runs as threaded code again until it is hot once more.
+void
+Machine::JitCompile(FastBlock *block)
+{
+	if (!jit->Fits(block))
+	{
+		std::unordered_map<uint64_t, FastBlock*>::iterator it;
+		for (it = fastBlocks.begin(); it != fastBlocks.end(); ++it)
+		{
+			it->second->native = NULL;
+			it->second->execCount = 0;
+		}
+		jit->Reset();
+		dprintf("jit: code buffer full, compiled code flushed.\n");
+	}
+	block->native = jit->Compile(block);
+}
+
+// A store into [addr, addr + size) of a code page: only the blocks
+// holding those bytes are dropped, along with the chains into them.
+// Blocks never cross a page.
+void
+Machine::FastInvalidate(uint64_t addr, int size)
+{
+	std::unordered_map<uint64_t, std::vector<FastBlock*> >::iterator page = codePage.find(addr / PageSize);
+	if (page == codePage.end())
+		return;
+
+	std::vector<FastBlock*> &blocks = page->second;
+	std::set<FastBlock*> stale;
+	for (size_t i = 0; i < blocks.size(); )
+	{
+		FastBlock *b = blocks[i];
+		if (addr < b->adr + 4 * b->num && addr + size > b->adr)
+		{
+			stale.insert(b);
+			blocks[i] = blocks.back();
+			blocks.pop_back();
+		}
+		else
+			++i;
+	}
+	if (blocks.empty())
+		codePage.erase(page);
+	if (stale.empty())
+		return;
+
+	std::unordered_map<uint64_t, FastBlock*>::iterator it;
+	for (it = fastBlocks.begin(); it != fastBlocks.end(); )
+	{
+		FastBlock *b = it->second;
+		if (stale.count(b))
+		{
+			it = fastBlocks.erase(it);
+			continue;
+		}
+		for (int k = 0; k < 2; ++k)
+			if (stale.count(b->succ[k]))
+				b->succ[k] = NULL;
+		++it;
+	}
+	std::set<FastBlock*>::iterator s;
+	for (s = stale.begin(); s != stale.end(); ++s)
+	{
+		delete [] (*s)->ops;
+		delete *s;
+	}
+	dprintf("fast: %d blocks at 0x%llx invalidated.\n", (int)stale.size(), addr);
+}
+
+// Threaded-code interpreter. Blocks are chains of FastOp whose handlers
+// are the labels below, each handler jumps straight to the next one.
+void
+Machine::FastRun()
+{
+	void *label[FastOpNum];
+	label[Op_add] = &&L_add;		label[Op_mul] = &&L_mul;
+	label[Op_sub] = &&L_sub;		label[Op_sll] = &&L_sll;
+	label[Op_mulh] = &&L_mulh;		label[Op_slt] = &&L_slt;
+	label[Op_xor] = &&L_xor;		label[Op_div] = &&L_div;
+	label[Op_srl] = &&L_srl;		label[Op_sra] = &&L_sra;
+	label[Op_or] = &&L_or;			label[Op_rem] = &&L_rem;
+	label[Op_and] = &&L_and;		label[Op_lb] = &&L_lb;
+	label[Op_lh] = &&L_lh;			label[Op_lw] = &&L_lw;
+	label[Op_ld] = &&L_ld;			label[Op_addi] = &&L_addi;
+	label[Op_slli] = &&L_slli;		label[Op_slti] = &&L_slti;
+	label[Op_xori] = &&L_xori;		label[Op_srli] = &&L_srli;
+	label[Op_srai] = &&L_srai;		label[Op_ori] = &&L_ori;
+	label[Op_andi] = &&L_andi;		label[Op_addiw] = &&L_addiw;
+	label[Op_jalr] = &&L_jalr;		label[Op_ecall] = &&L_slow;
+	label[Op_sb] = &&L_sb;			label[Op_sh] = &&L_sh;
+	label[Op_sw] = &&L_sw;			label[Op_sd] = &&L_sd;
+	label[Op_beq] = &&L_beq;		label[Op_bne] = &&L_bne;
+	label[Op_blt] = &&L_blt;		label[Op_bge] = &&L_bge;
+	label[Op_auipc] = &&L_auipc;	label[Op_lui] = &&L_lui;
+	label[Op_jal] = &&L_jal;		label[Op_bltu] = &&L_bltu;
+	label[Op_bgeu] = &&L_bgeu;		label[Op_lbu] = &&L_lbu;
+	label[Op_lhu] = &&L_lhu;		label[Op_lwu] = &&L_lwu;
+	label[Op_sltiu] = &&L_sltiu;	label[Op_sltu] = &&L_sltu;
+	label[Op_slliw] = &&L_slliw;	label[Op_srliw] = &&L_srliw;
+	label[Op_sraiw] = &&L_sraiw;	label[Op_addw] = &&L_addw;
+	label[Op_subw] = &&L_subw;		label[Op_sllw] = &&L_sllw;
+	label[Op_srlw] = &&L_srlw;		label[Op_sraw] = &&L_sraw;
+	label[FastOpEnd] = &&L_end;		label[FastOpSlow] = &&L_slow;
+
+	Timer timer;
+	int64_t *r = reg;
+	uint64_t pc = ReadReg(PCReg), addr;
+	FastBlock *block, *next;
+	FastOp *op;
+	uint8_t *host;
+	int taken;
+
+	runTime = 0;
+
+#define NEXT()		do { ++op; goto *op->handler; } while (0)
+#define RS1			r[op->rs1]
+#define RS2			r[op->rs2]
+#define RD			r[op->rd]
+#define LOAD(type, size) \
+	addr = RS1 + op->imm; \
+	if ((host = FastHost(addr, size, false)) == NULL) goto L_slow; \
+	RD = *(type*)host; \
+	NEXT()
+#define STORE(type, size) \
+	addr = RS1 + op->imm; \
+	if ((host = FastHost(addr, size, true)) == NULL) goto L_slow; \
+	*(type*)host = (type)RS2; \
+	NEXT()
+
+LOOKUP:
+	{
+		std::unordered_map<uint64_t, FastBlock*>::iterator it = fastBlocks.find(pc);
+		if (it == fastBlocks.end())
+			block = fastBlocks[pc] = FastTranslate(pc, label);
+		else
+			block = it->second;
+	}
+ENTER:
+	if (block->native != NULL)
+	{
+		taken = block->native(r, this);
+		if (taken < 0)
+		{
+			op = block->ops + (-taken - 1);
+			goto L_slow;
+		}
+		pc = ReadReg(PCReg);
+		goto BLOCK_END;
+	}
+	if (jit != NULL && ++block->execCount == JitThreshold)
+		JitCompile(block);
+	op = block->ops;
+	goto *op->handler;
+
+L_add:		RD = RS1 + RS2; NEXT();
+L_mul:		RD = RS1 * RS2; NEXT();
+L_sub:		RD = RS1 - RS2; NEXT();
+L_sll:		RD = RS1 << RS2; NEXT();
+L_mulh:		RD = (int64_t)(((__int128_t)RS1 * (__int128_t)RS2) >> 64); NEXT();
+L_slt:		RD = RS1 < RS2 ? 1 : 0; NEXT();
+L_sltu:		RD = (uint64_t)RS1 < (uint64_t)RS2 ? 1 : 0; NEXT();
+L_xor:		RD = RS1 ^ RS2; NEXT();
+L_div:		RD = RS1 / RS2; NEXT();
+L_srl:		RD = (int64_t)((uint64_t)RS1 >> RS2); NEXT();
+L_sra:		RD = RS1 >> RS2; NEXT();
+L_or:		RD = RS1 | RS2; NEXT();
+L_rem:		RD = RS1 % RS2; NEXT();
+L_and:		RD = RS1 & RS2; NEXT();
+L_addw:		RD = (int64_t)((int32_t)(RS1 + RS2)); NEXT();
+L_subw:		RD = (int64_t)((int32_t)(RS1 - RS2)); NEXT();
+L_sllw:		RD = (int64_t)((int32_t)RS1 << RS2); NEXT();
+L_srlw:		RD = (uint64_t)((uint32_t)RS1 >> RS2); NEXT();
+L_sraw:		RD = (int64_t)((int32_t)RS1 >> RS2); NEXT();
+
+L_addi:		RD = RS1 + op->imm; NEXT();
+L_slli:		RD = RS1 << (op->imm & 0x3f); NEXT();
+L_slti:		RD = RS1 < op->imm ? 1 : 0; NEXT();
+L_sltiu:	RD = (uint64_t)RS1 < (uint64_t)op->imm ? 1 : 0; NEXT();
+L_xori:		RD = RS1 ^ op->imm; NEXT();
+L_srli:		RD = (int64_t)((uint64_t)RS1 >> (op->imm & 0x3f)); NEXT();
+L_srai:		RD = RS1 >> (op->imm & 0x3f); NEXT();
+L_ori:		RD = RS1 | op->imm; NEXT();
+L_andi:		RD = RS1 & op->imm; NEXT();
+L_addiw:	RD = (int64_t)((int32_t)(RS1 + op->imm)); NEXT();
+L_slliw:	RD = (int64_t)((int32_t)RS1 << (op->imm & 0x1f)); NEXT();
+L_srliw:	RD = (uint64_t)((uint32_t)RS1 >> (op->imm & 0x1f)); NEXT();
+L_sraiw:	RD = (int64_t)((int32_t)RS1 >> (op->imm & 0x1f)); NEXT();
+L_auipc:	RD = op->adr + op->imm; NEXT();
+L_lui:		RD = op->imm; NEXT();
+
+L_lb:		LOAD(int8_t, 1);
+L_lh:		LOAD(int16_t, 2);
+L_lw:		LOAD(int32_t, 4);
+L_ld:		LOAD(int64_t, 8);
+L_lbu:		LOAD(uint8_t, 1);
+L_lhu:		LOAD(uint16_t, 2);
+L_lwu:		LOAD(uint32_t, 4);
+L_sb:		STORE(uint8_t, 1);
+L_sh:		STORE(uint16_t, 2);
+L_sw:		STORE(uint32_t, 4);
+L_sd:		STORE(uint64_t, 8);
+
+L_beq:		taken = RS1 == RS2; goto BRANCH;
+L_bne:		taken = RS1 != RS2; goto BRANCH;
+L_blt:		taken = RS1 < RS2; goto BRANCH;
+L_bge:		taken = RS1 >= RS2; goto BRANCH;
+L_bltu:		taken = (uint64_t)RS1 < (uint64_t)RS2; goto BRANCH;
+L_bgeu:		taken = (uint64_t)RS1 >= (uint64_t)RS2; goto BRANCH;
+BRANCH:
+	pc = taken ? op->adr + op->imm : op->adr + 4;
+	goto BLOCK_END;
+
+L_jal:
+	RD = op->adr + 4;
+	pc = op->adr + op->imm;
+	taken = 1;
+	goto BLOCK_END;
+
+L_jalr:
+	addr = (RS1 + op->imm) & (-1ll ^ 0x1);
+	RD = op->adr + 4;
+	pc = addr;
+	taken = 1;
+	goto BLOCK_END;
+
+L_end:
+	pc = op->adr;
+	taken = 0;
+
+BLOCK_END:
+	instCount += block->num;
+	if (bbv != NULL)
+		bbv->Count(block->bbvId, block->num);
+	next = block->succ[taken];
+	if (next == NULL || next->adr != pc)
+	{
+		std::unordered_map<uint64_t, FastBlock*>::iterator it = fastBlocks.find(pc);
+		if (it == fastBlocks.end())
+			next = fastBlocks[pc] = FastTranslate(pc, label);
+		else
+			next = it->second;
+		block->succ[taken] = next;
+	}
+	block = next;
+	goto ENTER;
+
+L_slow:
+	// ecall, fault or untranslatable inst: one step on the generic path
+	instCount += op - block->ops;
+	if (bbv != NULL)
+		bbv->Count(block->bbvId, op - block->ops + 1);
+	WriteReg(PCReg, op->adr);
+	runTime += timer.StepTime();
+	Step();
+	runTime += timer.StepTime();
+	pc = ReadReg(PCReg);
+	goto LOOKUP;
+
+#undef NEXT
+#undef RS1
+#undef RS2
+#undef RD
+#undef LOAD
+#undef STORE
+}
@@ -0,0 +1,52 @@
+#ifndef FASTSIM_HEADER
+#define FASTSIM_HEADER
+
+#include <stdint.h>
+
+#define FastHostNum         64      // host page entries, power of 2
+#define FastBlockMaxLen     64      // instructions per block
+#define FastScratchReg      39      // sink for writes to x0
+
+#define FastOpEnd           OpNum           // fall through to next block
+#define FastOpSlow          (OpNum + 1)     // run one inst on slow path
+#define FastOpNum           (OpNum + 2)
+
+class Machine;
+
+// Compiled block entry, see Jit
+typedef int (*JitFunc)(int64_t *reg, Machine *machine);
+
+// One threaded-code operation, handler is a label inside Machine::FastRun
+class FastOp
+{
+public:
+    void *handler;
+    int optype;
+    uint32_t rd, rs1, rs2;
+    int64_t imm;
+    uint64_t adr;
+};
+
+// Straight-line guest code ending at a control transfer, an ecall, a
+// page boundary or an instruction the translator cannot handle
+class FastBlock
+{
+public:
+    uint64_t adr;
+    int num;                // guest instructions in the block
+    FastOp *ops;            // num ops plus the terminating op
+    FastBlock *succ[2];     // chained successors (not taken / taken)
+    uint64_t execCount;
+    JitFunc native;         // compiled code, NULL until the block is hot
+    int bbvId;              // basic-block vector id, see BbvProfiler
+};
+
+// Guest page to host pointer
+class FastHostEntry
+{
+public:
+    uint64_t vpn;
+    uint8_t *host;
+};
+
+#endif
@@ -0,0 +1,317 @@
+#include "machine.hpp"
+#include "jit.hpp"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JitSupported        1
+#else
+#define JitSupported        0
+#endif
+
+// host registers
+#define RAX                 0
+#define RCX                 1
+#define RDX                 2
+#define RSI                 6
+
+// x86 condition codes for setcc / cmovcc
+#define CondB               0x2
+#define CondAE              0x3
+#define CondE               0x4
+#define CondNE              0x5
+#define CondL               0xc
+#define CondGE              0xd
+
+Jit::Jit(JitHostFunc host)
+: compiled(0), base(NULL), cur(NULL), end(NULL), epilogue(NULL), hostFunc(host)
+{
+#if JitSupported
+	void *p = mmap(NULL, JitCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		vprintf("[Error] Code buffer unavailable [Jit]\n");
+		return;
+	}
+	base = (uint8_t*)p;
+	end = base + JitCodeSize;
+	Reset();
+#endif
+}
+
+Jit::~Jit()
+{
+#if JitSupported
+	if (base != NULL)
+		munmap(base, JitCodeSize);
+#endif
+}
+
+// Drop all compiled code, the shared epilogue is re-emitted at the start
+void
+Jit::Reset()
+{
+	if (base == NULL)
+		return;
+
+	cur = base;
+	compiled = 0;
+
+	// pop r13; pop r12; pop rbx; ret
+	epilogue = cur;
+	EmitBytes("\x41\x5d\x41\x5c\x5b\xc3", 6);
+}
+
+void
+Jit::EmitBytes(const char *bytes, int len)
+{
+	memcpy(cur, bytes, len);
+	cur += len;
+}
+
+// mov x86, [rbx + 8*rid]
+void
+Jit::LoadReg(int x86, int rid)
+{
+	Emit8(0x48); Emit8(0x8b); Emit8(0x83 | (x86 << 3));
+	Emit32(rid * 8);
+}
+
+// mov [rbx + 8*rid], rax
+void
+Jit::StoreReg(int rid)
+{
+	Emit8(0x48); Emit8(0x89); Emit8(0x83);
+	Emit32(rid * 8);
+}
+
+// movabs x86, imm
+void
+Jit::LoadImm(int x86, uint64_t imm)
+{
+	Emit8(0x48); Emit8(0xb8 + x86);
+	Emit64(imm);
+}
+
+// mov eax, ret; jmp epilogue
+void
+Jit::EmitExit(int ret)
+{
+	Emit8(0xb8); Emit32(ret);
+	Emit8(0xe9); Emit32(epilogue - (cur + 4));
+}
+
+// rax = rs1 op (rs2 or imm), then write rd
+void
+Jit::EmitAlu(FastOp *op, int optype)
+{
+	switch (optype)
+	{
+		case Op_lui:
+			LoadImm(RAX, op->imm);
+			StoreReg(op->rd);
+			return;
+		case Op_auipc:
+			LoadImm(RAX, op->adr + op->imm);
+			StoreReg(op->rd);
+			return;
+		// I-type: immediate in rcx, then share the R-type encoding
+		case Op_addi:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm); optype = Op_add; break;
+		case Op_slti:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm); optype = Op_slt; break;
+		case Op_sltiu:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm); optype = Op_sltu; break;
+		case Op_xori:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm); optype = Op_xor; break;
+		case Op_ori:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm); optype = Op_or; break;
+		case Op_andi:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm); optype = Op_and; break;
+		case Op_slli:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm & 0x3f); optype = Op_sll; break;
+		case Op_srli:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm & 0x3f); optype = Op_srl; break;
+		case Op_srai:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm & 0x3f); optype = Op_sra; break;
+		case Op_addiw:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm); optype = Op_addw; break;
+		case Op_slliw:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm & 0x1f); optype = Op_sllw; break;
+		case Op_srliw:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm & 0x1f); optype = Op_srlw; break;
+		case Op_sraiw:	LoadReg(RAX, op->rs1); LoadImm(RCX, op->imm & 0x1f); optype = Op_sraw; break;
+		default:		LoadReg(RAX, op->rs1); LoadReg(RCX, op->rs2); break;
+	}
+
+	switch (optype)
+	{
+		case Op_add:	EmitBytes("\x48\x01\xc8", 3); break;						// add rax, rcx
+		case Op_sub:	EmitBytes("\x48\x29\xc8", 3); break;						// sub rax, rcx
+		case Op_and:	EmitBytes("\x48\x21\xc8", 3); break;						// and rax, rcx
+		case Op_or:		EmitBytes("\x48\x09\xc8", 3); break;						// or rax, rcx
+		case Op_xor:	EmitBytes("\x48\x31\xc8", 3); break;						// xor rax, rcx
+		case Op_mul:	EmitBytes("\x48\x0f\xaf\xc1", 4); break;					// imul rax, rcx
+		case Op_mulh:	EmitBytes("\x48\xf7\xe9\x48\x89\xd0", 6); break;			// imul rcx; mov rax, rdx
+		case Op_div:	EmitBytes("\x48\x99\x48\xf7\xf9", 5); break;				// cqo; idiv rcx
+		case Op_rem:	EmitBytes("\x48\x99\x48\xf7\xf9\x48\x89\xd0", 8); break;	// cqo; idiv rcx; mov rax, rdx
+		case Op_sll:	EmitBytes("\x48\xd3\xe0", 3); break;						// shl rax, cl
+		case Op_srl:	EmitBytes("\x48\xd3\xe8", 3); break;						// shr rax, cl
+		case Op_sra:	EmitBytes("\x48\xd3\xf8", 3); break;						// sar rax, cl
+		case Op_slt:	EmitBytes("\x48\x39\xc8\x0f\x9c\xc0\x48\x0f\xb6\xc0", 10); break;	// cmp; setl; movzx
+		case Op_sltu:	EmitBytes("\x48\x39\xc8\x0f\x92\xc0\x48\x0f\xb6\xc0", 10); break;	// cmp; setb; movzx
+		case Op_addw:	EmitBytes("\x01\xc8\x48\x63\xc0", 5); break;				// add eax, ecx; movsxd
+		case Op_subw:	EmitBytes("\x29\xc8\x48\x63\xc0", 5); break;				// sub eax, ecx; movsxd
+		case Op_sllw:	EmitBytes("\xd3\xe0\x48\x63\xc0", 5); break;				// shl eax, cl; movsxd
+		case Op_srlw:	EmitBytes("\xd3\xe8", 2); break;							// shr eax, cl
+		case Op_sraw:	EmitBytes("\xd3\xf8\x48\x63\xc0", 5); break;				// sar eax, cl; movsxd
+	}
+	StoreReg(op->rd);
+}
+
+// Host pointer from the helper, exit to the slow path at op index on NULL
+void
+Jit::EmitMem(FastOp *op, int optype, int index)
+{
+	int size, write = 0;
+	switch (optype)
+	{
+		case Op_lb: case Op_lbu: size = 1; break;
+		case Op_lh: case Op_lhu: size = 2; break;
+		case Op_lw: case Op_lwu: size = 4; break;
+		case Op_ld: size = 8; break;
+		case Op_sb: size = 1; write = 1; break;
+		case Op_sh: size = 2; write = 1; break;
+		case Op_sw: size = 4; write = 1; break;
+		default: size = 8; write = 1; break;
+	}
+
+	LoadReg(RSI, op->rs1);
+	Emit8(0x48); Emit8(0x81); Emit8(0xc6); Emit32(op->imm);	// add rsi, imm32
+	EmitBytes("\x4c\x89\xe7", 3);							// mov rdi, r12
+	Emit8(0xba); Emit32(size);								// mov edx, size
+	Emit8(0xb9); Emit32(write);								// mov ecx, write
+	LoadImm(RAX, (uint64_t)hostFunc);
+	EmitBytes("\xff\xd0", 2);								// call rax
+	EmitBytes("\x48\x85\xc0\x75\x0a", 5);					// test rax, rax; jnz +10
+	EmitExit(-(index + 1));
+
+	if (write)
+	{
+		LoadReg(RCX, op->rs2);
+		switch (size)
+		{
+			case 1: EmitBytes("\x88\x08", 2); break;			// mov [rax], cl
+			case 2: EmitBytes("\x66\x89\x08", 3); break;		// mov [rax], cx
+			case 4: EmitBytes("\x89\x08", 2); break;			// mov [rax], ecx
+			case 8: EmitBytes("\x48\x89\x08", 3); break;		// mov [rax], rcx
+		}
+		return;
+	}
+
+	switch (optype)
+	{
+		case Op_lb:		EmitBytes("\x48\x0f\xbe\x00", 4); break;	// movsx rax, byte [rax]
+		case Op_lh:		EmitBytes("\x48\x0f\xbf\x00", 4); break;	// movsx rax, word [rax]
+		case Op_lw:		EmitBytes("\x48\x63\x00", 3); break;		// movsxd rax, [rax]
+		case Op_ld:		EmitBytes("\x48\x8b\x00", 3); break;		// mov rax, [rax]
+		case Op_lbu:	EmitBytes("\x0f\xb6\x00", 3); break;		// movzx eax, byte [rax]
+		case Op_lhu:	EmitBytes("\x0f\xb7\x00", 3); break;		// movzx eax, word [rax]
+		case Op_lwu:	EmitBytes("\x8b\x00", 2); break;			// mov eax, [rax]
+	}
+	StoreReg(op->rd);
+}
+
+// Block terminators: next pc to reg[PCReg], taken flag to eax
+void
+Jit::EmitBranch(FastOp *op, int optype)
+{
+	int cond;
+	switch (optype)
+	{
+		case Op_jal:
+			LoadImm(RAX, op->adr + 4);
+			StoreReg(op->rd);
+			LoadImm(RAX, op->adr + op->imm);
+			StoreReg(PCReg);
+			EmitExit(1);
+			return;
+		case Op_jalr:
+			LoadReg(RAX, op->rs1);
+			Emit8(0x48); Emit8(0x05); Emit32(op->imm);		// add rax, imm32
+			EmitBytes("\x48\x83\xe0\xfe", 4);				// and rax, -2
+			StoreReg(PCReg);
+			LoadImm(RAX, op->adr + 4);
+			StoreReg(op->rd);
+			EmitExit(1);
+			return;
+		case Op_beq:	cond = CondE; break;
+		case Op_bne:	cond = CondNE; break;
+		case Op_blt:	cond = CondL; break;
+		case Op_bge:	cond = CondGE; break;
+		case Op_bltu:	cond = CondB; break;
+		default:		cond = CondAE; break;
+	}
+
+	LoadReg(RAX, op->rs1);
+	LoadReg(RCX, op->rs2);
+	EmitBytes("\x48\x39\xc8", 3);							// cmp rax, rcx
+	LoadImm(RDX, op->adr + 4);
+	LoadImm(RSI, op->adr + op->imm);
+	Emit8(0x48); Emit8(0x0f); Emit8(0x40 | cond); Emit8(0xd6);	// cmovcc rdx, rsi
+	Emit8(0x48); Emit8(0x89); Emit8(0x93); Emit32(PCReg * 8);	// mov [rbx + pc], rdx
+	Emit8(0x0f); Emit8(0x90 | cond); Emit8(0xc0);				// setcc al
+	EmitBytes("\x0f\xb6\xc0", 3);								// movzx eax, al
+	Emit8(0xe9); Emit32(epilogue - (cur + 4));
+}
+
+// Translate a threaded-code block, NULL if it cannot be compiled
+JitFunc
+Jit::Compile(FastBlock *block)
+{
+	if (base == NULL)
+		return NULL;
+	if (!Fits(block))
+	{
+		dprintf("jit: code buffer full.\n");
+		return NULL;
+	}
+
+	uint8_t *entry = cur;
+	// push rbx; push r12; push r13; mov rbx, rdi; mov r12, rsi
+	EmitBytes("\x53\x41\x54\x41\x55\x48\x89\xfb\x49\x89\xf4", 11);
+
+	bool closed = false;
+	for (int i = 0; i < block->num; ++i)
+	{
+		FastOp *op = block->ops + i;
+		switch (op->optype)
+		{
+			case Op_lb: case Op_lh: case Op_lw: case Op_ld:
+			case Op_lbu: case Op_lhu: case Op_lwu:
+			case Op_sb: case Op_sh: case Op_sw: case Op_sd:
+				EmitMem(op, op->optype, i);
+				break;
+			case Op_beq: case Op_bne: case Op_blt: case Op_bge:
+			case Op_bltu: case Op_bgeu: case Op_jal: case Op_jalr:
+				EmitBranch(op, op->optype);
+				closed = true;
+				break;
+			case Op_ecall:
+				cur = entry;
+				return NULL;
+			default:
+				EmitAlu(op, op->optype);
+				break;
+		}
+	}
+
+	// blocks cut by length or page fall through, others leave via the slow path
+	FastOp *term = block->ops + block->num;
+	if (closed)
+		;
+	else if (term->optype == FastOpSlow)
+	{
+		EmitExit(-(block->num + 1));
+	}
+	else
+	{
+		LoadImm(RAX, term->adr);
+		StoreReg(PCReg);
+		EmitExit(0);
+	}
+
+	compiled++;
+	dprintf("jit: block 0x%llx, %d bytes.\n", block->adr, (int)(cur - entry));
+	return (JitFunc)entry;
+}
@@ -0,0 +1,55 @@
+#ifndef JIT_HEADER
+#define JIT_HEADER
+
+#include "fastsim.hpp"
+#include "utils.hpp"
+#include <stdint.h>
+
+#define JitCodeSize         (16 << 20)  // bytes of host code
+#define JitThreshold        32          // block executions before compiling
+#define JitMaxOpBytes       96          // upper bound of host code per guest op
+
+class Machine;
+
+// Host memory helper called by compiled loads and stores, returns NULL
+// when the access has to go to the slow path
+typedef uint8_t *(*JitHostFunc)(Machine *machine, uint64_t addr, int size, int write);
+
+// Basic-block translator to x86-64. A compiled block runs on the guest
+// register file directly and returns the taken flag of its final branch
+// (next pc in reg[PCReg]), or -(k+1) when op k must run on the slow path.
+class Jit
+{
+public:
+    Jit(JitHostFunc host);
+    ~Jit();
+
+    bool Available() { return base != NULL; }
+    // room left for the code of block
+    bool Fits(FastBlock *block) { return end - cur >= (block->num + 2) * JitMaxOpBytes; }
+    JitFunc Compile(FastBlock *block);
+    void Reset();
+
+    int compiled;
+
+private:
+    void Emit8(uint8_t v)     { *cur++ = v; }
+    void Emit32(uint32_t v)   { *(uint32_t*)cur = v; cur += 4; }
+    void Emit64(uint64_t v)   { *(uint64_t*)cur = v; cur += 8; }
+    void EmitBytes(const char *bytes, int len);
+    void LoadReg(int x86, int rid);
+    void StoreReg(int rid);
+    void LoadImm(int x86, uint64_t imm);
+    void EmitExit(int ret);
+    void EmitAlu(FastOp *op, int optype);
+    void EmitMem(FastOp *op, int optype, int index);
+    void EmitBranch(FastOp *op, int optype);
+
+    uint8_t *base, *cur, *end;
+    uint8_t *epilogue;
+    JitHostFunc hostFunc;
+
+    DISALLOW_COPY_AND_ASSIGN(Jit);
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "machine.hpp"
+#include "jit.hpp"
 #include "utils.hpp"
 
 void SingleStepInfo()
@@ -75,10 +77,17 @@ Machine::Machine(bool singleStep)
 	for (int i = 0; i < PhysicalPageNum; ++i)
 		freePage.push(i);
 	pte = new PageTableEntry[PhysicalPageNum];
+	TlbFlush();
 
 	instCount = 1;
 	runTime = .0;
 
+	fastMode = false;
+	jit = NULL;
+	bbv = NULL;
+	for (int i = 0; i < FastHostNum; ++i)
+		fastRead[i].vpn = fastWrite[i].vpn = -1;
+
 	if(singleStep)
 		SingleStepInfo();
 }
@@ -87,6 +96,35 @@ Machine::~Machine()
 {
 	delete mem;
 	delete pte;
+	delete jit;
+	delete bbv;
+}
+
+void
+Machine::Step()
+{
+	if (!Fetch())
+	{
+		panic("Fetch error!\n");
+	}
+	if (!Decode())
+	{
+		panic("Decode error!\n");
+	}
+	if (!Execute())
+	{
+		panic("Execute error!\n");
+	}
+	if (!MemoryAccess())
+	{
+		panic("Memory error!\n");
+	}
+	if (!WriteBack())
+	{
+		panic("WriteBack error!\n");
+	}
+	WriteReg(0, 0);
+	instCount++;
 }
 
 void
@@ -94,32 +132,17 @@ Machine::Run()
 {
 	Timer timer;
 
+	if (fastMode && !singleStep)
+	{
+		FastRun();
+		return;
+	}
+
 	runTime = 0;
     for ( ; ; )
     {
     	timer.StepTime();
-		if (!Fetch())
-		{
-			panic("Fetch error!\n");
-		}
-		if (!Decode())
-		{
-			panic("Decode error!\n");
-		}
-		if (!Execute())
-		{
-			panic("Execute error!\n");
-		}
-		if (!MemoryAccess())
-		{
-			panic("Memory error!\n");
-		}
-		if (!WriteBack())
-		{
-			panic("WriteBack error!\n");
-		}
-    	WriteReg(0, 0);
-		instCount++;
+		Step();
 		runTime += timer.StepTime();
 
     	if (singleStep)
@@ -139,7 +162,7 @@ Machine::Status(FILE *fout)
 	}
 	fprintf(fout, "\n---------------- Machine ---------------\n");
 	fprintf(fout, "BASIC STATUS: \n");
-	fprintf(fout, "- Inst. Count:    %d\n", instCount);
+	fprintf(fout, "- Inst. Count:    %llu\n", instCount);
 	fprintf(fout, "- Run Time:       %.4lf\n", runTime);
 	fprintf(fout, "- IpS:            %.2lf\n", (double)instCount/runTime);
 	fprintf(fout, "\nREGISTER FILE: \n");
@@ -3,8 +3,14 @@
 
 #include "memory.hpp"
 #include "riscsim.hpp"
+#include "fastsim.hpp"
+#include "bbv.hpp"
+#include <stdio.h>
 #include <map>
+#include <set>
 #include <queue>
+#include <unordered_map>
+#include <vector>
 
 #define SPReg               2
 #define A0Reg               10
@@ -24,6 +30,8 @@
 #define StackTopPtr         0x80000000
 #define StackPageNum        5
 
+class Jit;
+
 class Machine 
 {
 public:
@@ -40,6 +48,7 @@ public:
     bool ReadMem(uint64_t addr, int size, void *value);
     bool WriteMem(uint64_t addr, int size, uint64_t value);
     bool Translate(uint64_t v_addr, uint64_t *p_addr, int size);
+    void TlbFlush();
     void PrintMem(FILE *fout = NULL);
     void PrintPageTable(FILE *fout = NULL);
 
@@ -50,6 +59,15 @@ public:
     bool Execute();
     bool MemoryAccess();
     bool WriteBack();
+    void Step();
+
+    // fast functional mode (threaded code)
+    void FastRun();
+    FastBlock *FastTranslate(uint64_t adr, void **label);
+    uint8_t *FastHost(uint64_t addr, int size, bool write);
+    void FastInvalidate(uint64_t addr, int size);
+    bool JitInit();
+    void JitCompile(FastBlock *block);
 
     void Run();
     void Status(FILE *fout = NULL);
@@ -60,6 +78,7 @@ public:
     uint8_t *mem;
     std::map<uint64_t, PageTableEntry*> pageTable;
     PageTableEntry *pte;
+    TlbEntry tlb[TlbSize];
     std::priority_queue<uint64_t> freePage;
 
     Instruction f_inst, d_inst, e_inst, m_inst, w_inst;
@@ -67,8 +86,15 @@ public:
     bool f_bubble, d_bubble, e_bubble, m_bubble, w_bubble;
     bool f_stall, d_stall, e_stall, m_stall, w_stall;
 
+    bool fastMode;
+    std::unordered_map<uint64_t, FastBlock*> fastBlocks;
+    std::unordered_map<uint64_t, std::vector<FastBlock*> > codePage;   // translated blocks by page
+    FastHostEntry fastRead[FastHostNum], fastWrite[FastHostNum];
+    Jit *jit;                      // hot block compiler, NULL when off
+    BbvProfiler *bbv;              // basic-block vectors, NULL when off
+
     bool singleStep;
-    int instCount;
+    uint64_t instCount;
     double runTime;
 };
 
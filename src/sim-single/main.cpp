@@ -13,6 +13,10 @@ using namespace boost::program_options;
 
 Machine *machine;
 bool singleStep = false;
+bool fastMode = false;
+bool jitMode = false;
+string bbvName;
+uint64_t bbvInterval = BbvDefaultInterval;
 string fileName;
 
 void ParseArg(int argc, char *argv[])
@@ -21,6 +25,10 @@ void ParseArg(int argc, char *argv[])
 
     opts.add_options()
         (",s", "single step")
+        ("fast,F", "fast functional mode (threaded code)")
+        ("jit", "compile hot blocks to host code, implies -F")
+        ("bbv", value<string>(), "write basic-block vectors (SimPoint .bb) to file, implies -F")
+        ("bbv-interval", value<uint64_t>(), "insts per basic-block vector (default 10M)")
         ("verbose,v", "print more info")
         ("debug,d", "print debug info")
         ("filename,f", value<string>()->required(), "riscv elf file")
@@ -42,6 +50,25 @@ void ParseArg(int argc, char *argv[])
 	verbose = true;
     }
 
+    if(vm.count("fast"))
+    {
+        fastMode = true;
+    }
+
+    if(vm.count("jit"))
+    {
+        fastMode = true;
+        jitMode = true;
+    }
+
+    if(vm.count("bbv"))
+    {
+        fastMode = true;
+        bbvName = vm["bbv"].as<string>();
+        if (vm.count("bbv-interval"))
+            bbvInterval = vm["bbv-interval"].as<uint64_t>();
+    }
+
     if(vm.count("debug"))
     {
         debug = true;
@@ -65,7 +92,9 @@ void ParseArg(int argc, char *argv[])
 
     printf("[verbose]  %s\n", verbose?"on":"off");
     printf("[debug]    %s\n", debug?"on":"off");
-    printf("[single]   %s\n\n", singleStep?"on":"off");
+    printf("[single]   %s\n", singleStep?"on":"off");
+    printf("[fast]     %s\n", fastMode?"on":"off");
+    printf("[jit]      %s\n\n", jitMode?"on":"off");
 }
 
 void LoadELF()
@@ -129,6 +158,19 @@ int main(int argc, char *argv[])
 
     // build machine
     machine = new Machine(singleStep);
+    machine->fastMode = fastMode;
+    if (jitMode && !machine->JitInit())
+        printf("jit unavailable, using threaded code.\n");
+    if (!bbvName.empty())
+    {
+        FILE *bbvOut = fopen(bbvName.c_str(), "w");
+        if (bbvOut == NULL)
+        {
+            printf("can not open file %s.\n", bbvName.c_str());
+            exit(0);
+        }
+        machine->bbv = new BbvProfiler(bbvOut, bbvInterval);
+    }
     LoadELF();
 
     // machine run
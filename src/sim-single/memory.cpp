@@ -19,6 +19,7 @@ Machine::AllocatePage(uint64_t vpn)
 	pte[ppn].ppn = ppn;
 	pte[ppn].vpn = vpn;
 	pageTable[vpn] = (pte+ppn);
+	tlb[vpn & (TlbSize - 1)].vpn = ~0ull; // mapping may have changed
 
 	dprintf("Allocated physical page 0x%08llx for vp 0x%08llx.\n", ppn, vpn);
 
@@ -42,19 +43,22 @@ Machine::ReadMem(uint64_t addr, int size, void *value)
 		return false;
 	}
 
+	// the TLB entry filled by Translate points at the page in simulator memory
+	uint8_t *host = tlb[(addr / PageSize) & (TlbSize - 1)].host + addr % PageSize;
+
 	switch (size)
 	{
 		case 1:
-			*(uint8_t*)value = *(uint8_t*)(mem + p_addr);
+			*(uint8_t*)value = *(uint8_t*)host;
 			break;
 		case 2:
-			*(uint16_t*)value = *(uint16_t*)(mem + p_addr);
+			*(uint16_t*)value = *(uint16_t*)host;
 			break;
 		case 4:
-			*(uint32_t*)value = *(uint32_t*)(mem + p_addr);
+			*(uint32_t*)value = *(uint32_t*)host;
 			break;
 		case 8:
-			*(uint64_t*)value = *(uint64_t*)(mem + p_addr);
+			*(uint64_t*)value = *(uint64_t*)host;
 			break;
 		default:
 			vprintf("[Error] Wrong size %d. [ReadMem]\n", size);
@@ -81,25 +85,32 @@ Machine::WriteMem(uint64_t addr, int size, uint64_t value)
 		return false;
 	}
 
+	// the TLB entry filled by Translate points at the page in simulator memory
+	uint8_t *host = tlb[(addr / PageSize) & (TlbSize - 1)].host + addr % PageSize;
+
 	switch (size)
 	{
 		case 1:
-			*(uint8_t*)(mem + p_addr) = value;
+			*(uint8_t*)host = value;
 			break;
 		case 2:
-			*(uint16_t*)(mem + p_addr) = value;
+			*(uint16_t*)host = value;
 			break;
 		case 4:
-			*(uint32_t*)(mem + p_addr) = value;
+			*(uint32_t*)host = value;
 			break;
 		case 8:
-			*(uint64_t*)(mem + p_addr) = value;
+			*(uint64_t*)host = value;
 			break;
 		default:
 			vprintf("[Error] Wrong size %d. [WriteMem]\n", size);
 			return false;
 	}
 
+	// translated code holding these bytes is stale now
+	if (!codePage.empty())
+		FastInvalidate(addr, size);
+
 	return true;
 }
 
@@ -114,27 +125,44 @@ Machine::Translate(uint64_t v_addr, uint64_t *p_addr, int size)
 		return false;
 	}
 
-	// translate
+	// translate, soft TLB first
 	uint64_t vpn = v_addr / PageSize, offset = v_addr % PageSize;
+	TlbEntry *t = tlb + (vpn & (TlbSize - 1));
 
-	if (pageTable.find(vpn) == pageTable.end())
+	if (t->vpn != vpn)
 	{
-		vprintf("[Error] Page not found, vpn = 0x%llx. [Translate]\n", vpn);
-		return false;
-	}
+		std::map<uint64_t, PageTableEntry*>::iterator it = pageTable.find(vpn);
+		if (it == pageTable.end())
+		{
+			vprintf("[Error] Page not found, vpn = 0x%llx. [Translate]\n", vpn);
+			return false;
+		}
 
-	PageTableEntry *entry = pageTable[vpn];
-	if (!entry->valid)
-	{
-		// TODO - load on use
-		vprintf("Page Fault (page invalid), vpn = 0x%llx. [Translate]\n", vpn);
-		return false;
+		PageTableEntry *entry = it->second;
+		if (!entry->valid)
+		{
+			// TODO - load on use
+			vprintf("Page Fault (page invalid), vpn = 0x%llx. [Translate]\n", vpn);
+			return false;
+		}
+
+		t->vpn = vpn;
+		t->ppn = entry->ppn;
+		t->host = mem + entry->ppn * PageSize;
 	}
 
-	*p_addr = entry->ppn * PageSize + offset;
+	*p_addr = t->ppn * PageSize + offset;
 	return true;
 }
 
+// Drop all cached translations
+void
+Machine::TlbFlush()
+{
+	for (int i = 0; i < TlbSize; ++i)
+		tlb[i].vpn = ~0ull;
+}
+
 void
 Machine::PrintPageTable(FILE *fout)
 {
@@ -1,6 +1,8 @@
 #include "machine.hpp"
 #include "utils.hpp"
+#include "decode.hpp"
 #include <stdio.h>
+#include <stdlib.h>
 
 const char *op_str[60] =
 {
@@ -27,28 +29,10 @@ const char *reg_str[33] = {
     "t5", "t6", "pc"    
 };
 
-inline uint32_t
-maskvalue(int len, uint32_t &value)
-{
-	uint32_t res = value & ((1 << len) - 1);
-	value >>= len;
-	return res;
-}
-
-inline int64_t
-signext64(int len_src, uint64_t value)
-{
-	uint64_t sign = (1ll << (len_src - 1));
-	if (sign & value) // neg
-		return value | ((-1ll) ^ ((1ll << len_src) - 1));
-	else
-		return value & ((1ll << len_src) - 1);
-}
-
 bool
 Machine::Fetch()
 {
-	dprintf("\n**** Fetch Stage [%d] ****\n", instCount);
+	dprintf("\n**** Fetch Stage [%llu] ****\n", instCount);
 
 	Instruction *inst = &test_inst;	
 	uint64_t inst_adr = ReadReg(PCReg);
@@ -68,444 +52,11 @@ Machine::Fetch()
 bool
 Machine::Decode()
 {
-	dprintf("\n**** Decode Stage [%d] ****\n", instCount);
+	dprintf("\n**** Decode Stage [%llu] ****\n", instCount);
 
 	Instruction *inst = &test_inst;	
-	uint32_t value = inst->value;
-	uint32_t opcode = maskvalue(7, value);
-	inst->opcode = opcode;
-
-	// instruction type
-	switch (opcode)
-	{
-		case 0x33:
-		case 0x3b:
-			inst->type = Rtype;
-			inst->rd = maskvalue(5, value);
-			inst->func3 = maskvalue(3, value);
-			inst->rs1 = maskvalue(5, value);
-			inst->rs2 = maskvalue(5, value);
-			inst->func7 = maskvalue(7, value);
-			break;
-		case 0x03:
-		case 0x13:
-		case 0x1b:
-		case 0x67:
-		case 0x73:
-			inst->type = Itype;
-			inst->rd = maskvalue(5, value);
-			inst->func3 = maskvalue(3, value);
-			inst->rs1 = maskvalue(5, value);
-			inst->imm = maskvalue(12, value);
-			inst->func7 = (((inst->value) >> 26) & 0x3f);
-			inst->imm = signext64(12, inst->imm);
-			break;
-		case 0x23:
-			inst->type = Stype;
-			inst->imm = 0;
-			inst->imm |= maskvalue(5, value);
-			inst->func3 = maskvalue(3, value);
-			inst->rs1 = maskvalue(5, value);
-			inst->rs2 = maskvalue(5, value);
-			inst->imm |= (maskvalue(7, value) << 5);
-			inst->imm = signext64(12, inst->imm);
-			break;
-		case 0x63:
-			inst->type = SBtype;
-			inst->imm = 0;
-			inst->imm |= (maskvalue(1, value) << 11);
-			inst->imm |= (maskvalue(4, value) << 1);
-			inst->func3 = maskvalue(3, value);
-			inst->rs1 = maskvalue(5, value);
-			inst->rs2 = maskvalue(5, value);
-			inst->imm |= (maskvalue(6, value) << 5);
-			inst->imm |= (maskvalue(1, value) << 12);
-			inst->imm = signext64(13, inst->imm);
-			break;
-		case 0x17:
-		case 0x37:
-			inst->type = Utype;
-			inst->rd = maskvalue(5, value);
-			inst->imm = (maskvalue(20, value) << 12);
-			inst->imm = signext64(32, inst->imm);
-			break;
-		case 0x6f:
-			inst->type = UJtype;
-			inst->rd = maskvalue(5, value);
-			inst->imm = 0;
-			inst->imm |= (maskvalue(8, value) << 12);
-			inst->imm |= (maskvalue(1, value) << 11);
-			inst->imm |= (maskvalue(10, value) << 1);
-			inst->imm |= (maskvalue(1, value) << 20);
-			inst->imm = signext64(21, inst->imm);
-			break;
-		default:
-			vprintf("[Error] Unknown opcode 0x%02x. [Decode]\n", opcode);
-			return false;
-	}
-
-	// optype 
-	switch (inst->type)
-	{
-		case Rtype:
-			switch (inst->opcode)
-			{
-				case 0x33:
-					switch (inst->func3)
-					{
-						case 0x00:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_add;
-									break;
-								case 0x01:
-									inst->optype = Op_mul;
-									break;
-								case 0x20:
-									inst->optype = Op_sub;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x01:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_sll;
-									break;
-								case 0x01:
-									inst->optype = Op_mulh;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x02:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_slt;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						case 0x03:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_sltu;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						case 0x04:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_xor;
-									break;
-								case 0x01:
-									inst->optype = Op_div;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						case 0x05:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_srl;
-									break;
-								case 0x20:
-									inst->optype = Op_sra;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x06:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_or;
-									break;
-								case 0x01:
-									inst->optype = Op_rem;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						case 0x07:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_and;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;	
-						default:
-							goto R_UNKNOWN;		
-					}
-					break;
-				case 0x3b:
-					switch (inst->func3)
-					{
-						case 0x00:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_addw;
-									break;
-								case 0x20:
-									inst->optype = Op_subw;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x01:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_sllw;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-						case 0x05:
-							switch (inst->func7)
-							{
-								case 0x00:
-									inst->optype = Op_srlw;
-									break;
-								case 0x20:
-									inst->optype = Op_sraw;
-									break;
-								default:
-									goto R_UNKNOWN;	
-							}
-							break;
-					}
-					break;
-				default:
-					R_UNKNOWN:
-					vprintf("[Error] Unknown Rtype inst(opcode=0x%02x, func3=0x%02x, func7=0x%02x). [Decode]\n",
-							 inst->opcode, inst->func3, inst->func7);
-					return false;
-			}
-			break;
-		case Itype:
-			switch (inst->opcode)
-			{
-				case 0x03:
-					switch (inst->func3)
-					{
-						case 0x00:
-							inst->optype = Op_lb;
-							break;
-						case 0x01:
-							inst->optype = Op_lh;
-							break;
-						case 0x02:
-							inst->optype = Op_lw;
-							break;
-						case 0x03:
-							inst->optype = Op_ld;
-							break;
-						case 0x04:
-							inst->optype = Op_lbu;
-							break;
-						case 0x05:
-							inst->optype = Op_lhu;
-							break;
-						case 0x06:
-							inst->optype = Op_lwu;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				case 0x13:
-					switch (inst->func3)
-					{
-						case 0x00:
-							inst->optype = Op_addi;
-							break;
-						case 0x01:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_slli;
-							else
-								goto I_UNKNOWN;
-							break;
-						case 0x02:
-							inst->optype = Op_slti;
-							break;
-						case 0x03:
-							inst->optype = Op_sltiu;
-							break;
-						case 0x04:
-							inst->optype = Op_xori;
-							break;
-						case 0x05:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_srli;
-							else if (inst->func7 == 0x10)
-								inst->optype = Op_srai;
-							else
-								goto I_UNKNOWN;
-							break;
-						case 0x06:
-							inst->optype = Op_ori;
-							break;
-						case 0x07:
-							inst->optype = Op_andi;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				case 0x1b:
-					switch (inst->func3)
-					{
-						case 0x00:
-							inst->optype = Op_addiw;
-							break;
-						case 0x01:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_slliw;
-							else
-								goto I_UNKNOWN;
-							break;
-						case 0x05:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_srliw;
-							else if (inst->func7 == 0x10)
-								inst->optype = Op_sraiw;
-							else
-								goto I_UNKNOWN;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				case 0x67:
-					switch (inst->func3)
-					{
-						case 0x00:
-							inst->optype = Op_jalr;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				case 0x73:
-					switch (inst->func3)
-					{
-						case 0x00:
-							if (inst->func7 == 0x00)
-								inst->optype = Op_ecall;
-							else
-								goto I_UNKNOWN;
-							break;
-						default:
-							goto I_UNKNOWN;	
-					}
-					break;
-				default:
-					I_UNKNOWN:
-					vprintf("[Error] Unknown Itype inst(opcode=0x%02x, func3=0x%02x, func7=0x%02x). [Decode]\n",
-							 inst->opcode, inst->func3, inst->func7);
-					return false;	
-			}
-			break;
-		case Stype:
-			switch (inst->func3)
-			{
-				case 0x00:
-					inst->optype = Op_sb;
-					break;
-				case 0x01:
-					inst->optype = Op_sh;
-					break;
-				case 0x02:
-					inst->optype = Op_sw;
-					break;
-				case 0x03:
-					inst->optype = Op_sd;
-					break;
-				default:
-					vprintf("[Error] Unknown func3 0x%02x for Stype inst. [Decode]\n",
-							 inst->func3);
-					return false;
-			}
-			break;
-		case SBtype:
-			switch (inst->func3)
-			{
-				case 0x00:
-					inst->optype = Op_beq;
-					break;
-				case 0x01:
-					inst->optype = Op_bne;
-					break;
-				case 0x04:
-					inst->optype = Op_blt;
-					break;
-				case 0x05:
-					inst->optype = Op_bge;
-					break;
-				case 0x06:
-					inst->optype = Op_bltu;
-					break;
-				case 0x07:
-					inst->optype = Op_bgeu;
-					break;
-				default:
-					vprintf("[Error] Unknown func3 0x%02x for SBtype inst. [Decode]\n",
-							 inst->func3);
-					return false;
-			}
-			break;
-		case Utype:
-			switch (inst->opcode)
-			{
-				case 0x17:
-					inst->optype = Op_auipc;
-					break;
-				case 0x37:
-					inst->optype = Op_lui;
-					break;
-				default:
-					vprintf("[Error] Unknown opcode 0x%02x for Utype inst. [Decode]\n",
-							 inst->opcode);
-					return false;
-			}
-			break;
-		case UJtype:
-			switch (inst->opcode)
-			{
-				case 0x6f:
-					inst->optype = Op_jal;
-					break;
-				default:
-					vprintf("[Error] Unknown opcode 0x%02x for UJtype inst. [Decode]\n",
-							 inst->opcode);
-					return false;	
-			}
-			break;
-		default:
-			ASSERT(false);
-			// never reach
-	}
+	if (!inst->Decode())
+		return false;
 
 	if (debug || verbose)
 		inst->PrintInst();
@@ -523,7 +74,7 @@ Machine::Forward(int rid)
 bool
 Machine::Execute()
 {
-	dprintf("\n**** Execute Stage [%d] ****\n", instCount);
+	dprintf("\n**** Execute Stage [%llu] ****\n", instCount);
 
 	Instruction *inst = &test_inst;
 	int64_t val_a, val_b, val_e, val_c = 0;
@@ -779,7 +330,7 @@ Machine::Execute()
 bool
 Machine::MemoryAccess()
 {
-	dprintf("\n**** Memory Stage [%d] ****\n", instCount);
+	dprintf("\n**** Memory Stage [%llu] ****\n", instCount);
 
 	Instruction *inst = &test_inst;
 	int64_t val_e = ReadReg(E_ValEReg), val_c = ReadReg(E_ValCReg);
@@ -884,7 +435,7 @@ Machine::MemoryAccess()
 bool
 Machine::WriteBack()
 {
-	dprintf("\n**** WriteBack Stage [%d] ****\n", instCount);
+	dprintf("\n**** WriteBack Stage [%llu] ****\n", instCount);
 
 	// TODO Predict PC
 	WriteReg(PCReg, ReadReg(PCReg) + 4);
@@ -987,6 +538,8 @@ Machine::WriteBack()
 				    break;
 				case 93:
 					printf("User program exited.\n");
+					if (bbv != NULL)
+						bbv->Finish();
 					Status();
 					exit(0);
 					break;
@@ -1007,6 +560,12 @@ Machine::WriteBack()
 	return true;
 }
 
+bool
+Instruction::Decode()
+{
+	return DecodeInst(*this);
+}
+
 void
 Instruction::PrintInst()
 {
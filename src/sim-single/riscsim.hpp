@@ -41,6 +41,7 @@ class Instruction
     InstType type;
     OpType optype;
 
+    bool Decode();
     void PrintInst();
 };
 
@@ -14,6 +14,10 @@ extern bool debug;
         exit(-1);                                                             \
     }
 
+#define DISALLOW_COPY_AND_ASSIGN(TypeName) 	\
+	TypeName(const TypeName&); \
+	void operator=(const TypeName&)
+
 void dprintf(char *format, ...);
 void vprintf(char *format, ...);
 void panic(char *format, ...);
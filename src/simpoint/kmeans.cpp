@@ -0,0 +1,155 @@
+#include "kmeans.hpp"
+#include <math.h>
+#include <float.h>
+
+static uint32_t
+Rand(uint32_t &x)
+{
+	// xorshift32
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+double
+Dist2(const Point &a, const Point &b)
+{
+	double d = 0;
+	for (size_t i = 0; i < a.size(); ++i)
+		d += (a[i] - b[i]) * (a[i] - b[i]);
+	return d;
+}
+
+KMeans::KMeans(const std::vector<Point> &points, uint32_t seed)
+: points(points), seed(seed ? seed : 1)
+{
+}
+
+// k-means++ initial centers
+void
+KMeans::Seed(Clustering &c, uint32_t &rng)
+{
+	int n = points.size();
+	std::vector<double> d2(n, DBL_MAX);
+
+	c.center.clear();
+	c.center.push_back(points[Rand(rng) % n]);
+	while ((int)c.center.size() < c.k)
+	{
+		double sum = 0;
+		for (int i = 0; i < n; ++i)
+		{
+			double d = Dist2(points[i], c.center.back());
+			if (d < d2[i])
+				d2[i] = d;
+			sum += d2[i];
+		}
+
+		int pick = Rand(rng) % n;
+		if (sum > 0)
+		{
+			double r = (double)Rand(rng) / 4294967296.0 * sum;
+			for (pick = 0; pick < n - 1; ++pick)
+			{
+				r -= d2[pick];
+				if (r < 0)
+					break;
+			}
+		}
+		c.center.push_back(points[pick]);
+	}
+}
+
+// Nearest center for every point, true if any label changed
+bool
+KMeans::Assign(Clustering &c)
+{
+	bool changed = false;
+	c.distortion = 0;
+	for (size_t i = 0; i < points.size(); ++i)
+	{
+		int best = 0;
+		double best_d = DBL_MAX;
+		for (int j = 0; j < c.k; ++j)
+		{
+			double d = Dist2(points[i], c.center[j]);
+			if (d < best_d)
+			{
+				best_d = d;
+				best = j;
+			}
+		}
+		if (c.label[i] != best)
+		{
+			c.label[i] = best;
+			changed = true;
+		}
+		c.distortion += best_d;
+	}
+	return changed;
+}
+
+void
+KMeans::Update(Clustering &c)
+{
+	int dim = points[0].size();
+	c.size.assign(c.k, 0);
+	std::vector<Point> sum(c.k, Point(dim, 0));
+
+	for (size_t i = 0; i < points.size(); ++i)
+	{
+		c.size[c.label[i]]++;
+		for (int d = 0; d < dim; ++d)
+			sum[c.label[i]][d] += points[i][d];
+	}
+	for (int j = 0; j < c.k; ++j)
+		if (c.size[j]) // empty clusters keep their center
+			for (int d = 0; d < dim; ++d)
+				c.center[j][d] = sum[j][d] / c.size[j];
+}
+
+// Bayesian information criterion of a spherical Gaussian mixture with
+// shared variance (X-means), larger is better
+double
+KMeans::Bic(Clustering &c)
+{
+	double n = points.size(), dim = points[0].size();
+	double var = n > c.k ? c.distortion / (dim * (n - c.k)) : 0;
+	if (var < 1e-12)
+		var = 1e-12;
+
+	double l = -n * dim / 2 * log(2 * M_PI * var) - dim * (n - c.k) / 2;
+	for (int j = 0; j < c.k; ++j)
+		if (c.size[j])
+			l += c.size[j] * log(c.size[j] / n);
+
+	double params = (c.k - 1) + c.k * dim + 1;
+	return l - params / 2 * log(n);
+}
+
+Clustering
+KMeans::Run(int k)
+{
+	Clustering best;
+	best.distortion = DBL_MAX;
+	uint32_t rng = seed * 2654435761u + k;
+
+	for (int t = 0; t < KMeansTries; ++t)
+	{
+		Clustering c;
+		c.k = k;
+		c.label.assign(points.size(), -1);
+		Seed(c, rng);
+		for (int it = 0; it < KMeansMaxIter; ++it)
+		{
+			if (!Assign(c))
+				break;
+			Update(c);
+		}
+		if (c.distortion < best.distortion)
+			best = c;
+	}
+	best.bic = Bic(best);
+	return best;
+}
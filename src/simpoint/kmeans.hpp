@@ -0,0 +1,44 @@
+#ifndef KMEANS_HEADER
+#define KMEANS_HEADER
+
+#include <stdint.h>
+#include <vector>
+
+#define ProjectDim          15      // random projection dimensions
+#define KMeansMaxIter       100
+#define KMeansTries         5       // seeds per k, best distortion kept
+
+typedef std::vector<double> Point;
+
+// One clustering of the projected interval vectors
+class Clustering
+{
+public:
+	int k;
+	std::vector<int> label;         // cluster of each interval
+	std::vector<Point> center;
+	std::vector<int> size;
+	double distortion;              // sum of squared distances
+	double bic;
+};
+
+class KMeans
+{
+public:
+	KMeans(const std::vector<Point> &points, uint32_t seed);
+
+	Clustering Run(int k);
+
+private:
+	void Seed(Clustering &c, uint32_t &rng);
+	bool Assign(Clustering &c);
+	void Update(Clustering &c);
+	double Bic(Clustering &c);
+
+	const std::vector<Point> &points;
+	uint32_t seed;
+};
+
+double Dist2(const Point &a, const Point &b);
+
+#endif
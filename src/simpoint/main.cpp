@@ -0,0 +1,211 @@
+#include "kmeans.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <iostream>
+using namespace std;
+
+#include <boost/program_options.hpp>
+using namespace boost::program_options;
+
+typedef vector<pair<int, double> > SparseVec;
+
+string fileName, outName;
+int maxK = 10;
+uint64_t interval = 10000000;
+uint32_t seed = 1;
+double bicThreshold = 0.9;
+
+void ParseArg(int argc, char *argv[])
+{
+    options_description opts("SimPoint Options");
+
+    opts.add_options()
+        ("filename,f", value<string>(), "basic-block vector file (.bb)")
+        ("output,o", value<string>(), "output prefix (default: input file name)")
+        ("maxk,k", value<int>(), "largest number of clusters tried (default 10)")
+        ("interval,i", value<uint64_t>(), "insts per interval, for the printed commands (default 10M)")
+        ("seed", value<uint32_t>(), "random seed (default 1)")
+        ("help,h", "print help info")
+        ;
+    variables_map vm;
+
+    store(parse_command_line(argc, argv, opts), vm);
+
+    if(vm.count("help"))
+    {
+        cout << opts << endl;
+        exit(0);
+    }
+
+    if (vm.count("filename"))
+    {
+        fileName = vm["filename"].as<string>();
+    }
+    else
+    {
+        printf("please use -f to specify the .bb file.\n");
+        exit(0);
+    }
+
+    outName = vm.count("output") ? vm["output"].as<string>() : fileName;
+
+    if (vm.count("maxk"))
+    {
+        maxK = vm["maxk"].as<int>();
+        if (maxK < 1)
+        {
+            printf("maxk must be positive.\n");
+            exit(0);
+        }
+    }
+
+    if (vm.count("interval"))
+    {
+        interval = vm["interval"].as<uint64_t>();
+    }
+
+    if (vm.count("seed"))
+    {
+        seed = vm["seed"].as<uint32_t>();
+    }
+}
+
+// One "T:id:count :id:count ..." line per interval
+bool LoadBBV(vector<SparseVec> &bbv, int &maxId)
+{
+    FILE *fin = fopen(fileName.c_str(), "r");
+    if (fin == NULL)
+    {
+        printf("can not open file %s.\n", fileName.c_str());
+        return false;
+    }
+
+    maxId = 0;
+    int c, id;
+    unsigned long long cnt;
+    while ((c = fgetc(fin)) != EOF)
+    {
+        if (c != 'T')
+        {
+            // comment or blank line
+            while (c != '\n' && c != EOF)
+                c = fgetc(fin);
+            continue;
+        }
+
+        SparseVec v;
+        while (fscanf(fin, " :%d:%llu", &id, &cnt) == 2)
+        {
+            v.push_back(make_pair(id, (double)cnt));
+            if (id > maxId)
+                maxId = id;
+        }
+        bbv.push_back(v);
+    }
+    fclose(fin);
+    return true;
+}
+
+// Normalize each vector to frequencies, then project to ProjectDim
+// dimensions with a fixed random matrix
+void Project(const vector<SparseVec> &bbv, int maxId, vector<Point> &points)
+{
+    vector<double> matrix((size_t)(maxId + 1) * ProjectDim);
+    uint32_t x = seed;
+    for (size_t i = 0; i < matrix.size(); ++i)
+    {
+        x = x * 1664525u + 1013904223u;
+        matrix[i] = (double)x / 4294967296.0 * 2 - 1;
+    }
+
+    for (size_t i = 0; i < bbv.size(); ++i)
+    {
+        Point p(ProjectDim, 0);
+        double sum = 0;
+        for (size_t j = 0; j < bbv[i].size(); ++j)
+            sum += bbv[i][j].second;
+        for (size_t j = 0; j < bbv[i].size() && sum > 0; ++j)
+            for (int d = 0; d < ProjectDim; ++d)
+                p[d] += bbv[i][j].second / sum * matrix[(size_t)bbv[i][j].first * ProjectDim + d];
+        points.push_back(p);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    ParseArg(argc, argv);
+
+    vector<SparseVec> bbv;
+    vector<Point> points;
+    int maxId;
+    if (!LoadBBV(bbv, maxId))
+        return 0;
+    if (bbv.empty())
+    {
+        printf("no interval in %s.\n", fileName.c_str());
+        return 0;
+    }
+    Project(bbv, maxId, points);
+
+    // cluster for every k, keep the smallest k whose BIC reaches the
+    // threshold of the observed BIC range
+    KMeans kmeans(points, seed);
+    vector<Clustering> runs;
+    double lo = 0, hi = 0;
+    int kLimit = min(maxK, (int)points.size());
+    for (int k = 1; k <= kLimit; ++k)
+    {
+        runs.push_back(kmeans.Run(k));
+        double b = runs.back().bic;
+        if (k == 1 || b < lo) lo = b;
+        if (k == 1 || b > hi) hi = b;
+    }
+    int pick = 0;
+    while (pick < kLimit - 1 && runs[pick].bic < lo + bicThreshold * (hi - lo))
+        pick++;
+    Clustering &c = runs[pick];
+
+    printf("intervals: %d, blocks: %d, k: %d\n", (int)points.size(), maxId, c.k);
+    for (int k = 0; k < kLimit; ++k)
+        printf("  k = %2d  BIC %12.2lf%s\n", k + 1, runs[k].bic, k == pick ? "  <-" : "");
+
+    // representative interval: nearest to its cluster center
+    string spName = outName + ".simpoints", wName = outName + ".weights";
+    FILE *fsp = fopen(spName.c_str(), "w"), *fw = fopen(wName.c_str(), "w");
+    if (fsp == NULL || fw == NULL)
+    {
+        printf("can not write %s / %s.\n", spName.c_str(), wName.c_str());
+        return 0;
+    }
+
+    printf("\nsimpoint  weight    command\n");
+    for (int j = 0, id = 0; j < c.k; ++j)
+    {
+        if (c.size[j] == 0)
+            continue;
+        int best = -1;
+        double best_d = 0;
+        for (size_t i = 0; i < points.size(); ++i)
+            if (c.label[i] == j && (best == -1 || Dist2(points[i], c.center[j]) < best_d))
+            {
+                best = i;
+                best_d = Dist2(points[i], c.center[j]);
+            }
+        double weight = (double)c.size[j] / points.size();
+        fprintf(fsp, "%d %d\n", best, id);
+        fprintf(fw, "%lf %d\n", weight, id);
+        printf("%8d  %.4lf    --fast-forward %llu --warm --detail %llu\n", best, weight,
+               (unsigned long long)best * interval, (unsigned long long)interval);
+        id++;
+    }
+    fclose(fsp);
+    fclose(fw);
+    printf("\nwrote %s and %s, whole-program CPI = sum(weight * CPI).\n", spName.c_str(), wName.c_str());
+
+    return 0;
+}
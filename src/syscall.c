@@ -34,6 +34,31 @@ char sys_read_chr()
     asm("addi %0, a0, 0" : "=r" (result));
 }
 
+void sys_checkpoint()
+{
+	asm("addi a7, zero, 5");
+	asm("ecall");
+}
+
+void *sys_brk(void *addr)
+{
+    void *result;
+	asm("addi a7, zero, 214");
+	asm("ecall");
+    asm("addi %0, a0, 0" : "=r" (result));
+}
+
+void *sys_mmap(long len)
+{
+    void *result;
+	asm("addi a1, a0, 0");
+	asm("addi a0, zero, 0");
+	asm("addi a4, zero, -1");
+	asm("addi a7, zero, 222");
+	asm("ecall");
+    asm("addi %0, a0, 0" : "=r" (result));
+}
+
 void sys_exit(int x)
 {
 	asm("addi a7, zero, 93");
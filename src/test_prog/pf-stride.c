@@ -0,0 +1,26 @@
+#include<stdio.h>
+#include <syscall.h>
+
+// run with cfg/pf_stride.cfg: the stride is 256 B, the whole direct-mapped
+// L1D, so every prefetch falls into the set of the line being filled
+
+long long data[16 * 32];
+
+//result:1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16
+
+int main()
+{
+	int i=0;
+	for(i=0;i<16;i++)
+		data[i*32]=i+1;
+
+	// output
+	for (int i = 0; i < 16; i++)
+	{
+		sys_write_int(data[i*32]);
+		sys_write_chr(' ');
+	}
+	sys_write_chr('\n');
+	
+	return 0;
+}
@@ -0,0 +1,332 @@
+#include "trace.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+using namespace std;
+
+#include <boost/program_options.hpp>
+using namespace boost::program_options;
+
+#define ChunkRecords        4096
+
+const char *stage_str[] = {"F", "D", "E", "M", "W"};
+const char *cause_str[] = {"load-use", "control", "jalr", "ecall"};
+
+string fileName, outName;
+bool kanata = false;
+uint64_t startCycle = 0, numCycles = 0;
+
+vector<string> opName;
+FILE *fout;
+
+void ParseArg(int argc, char *argv[])
+{
+    options_description opts("Trace Decoder Options");
+
+    opts.add_options()
+        ("filename,f", value<string>(), "binary trace written by sim-cache --trace")
+        ("output,o", value<string>(), "output file (default stdout)")
+        ("kanata,k", "write Kanata log for the Konata pipeline viewer")
+        ("start,s", value<uint64_t>(), "first cycle to decode")
+        ("num,n", value<uint64_t>(), "number of cycles to decode (default all)")
+        ("help,h", "print help info")
+        ;
+    variables_map vm;
+
+    store(parse_command_line(argc, argv, opts), vm);
+
+    if(vm.count("help"))
+    {
+        cout << opts << endl;
+        exit(0);
+    }
+
+    if (vm.count("filename"))
+    {
+        fileName = vm["filename"].as<string>();
+    }
+    else
+    {
+        printf("please use -f to specify the trace file.\n");
+        exit(0);
+    }
+
+    if (vm.count("output"))
+    {
+        outName = vm["output"].as<string>();
+    }
+
+    if (vm.count("kanata"))
+    {
+        kanata = true;
+    }
+
+    if (vm.count("start"))
+    {
+        startCycle = vm["start"].as<uint64_t>();
+    }
+
+    if (vm.count("num"))
+    {
+        numCycles = vm["num"].as<uint64_t>();
+    }
+}
+
+bool ReadHeader(FILE *fin)
+{
+    uint64_t magic;
+    uint32_t version, size, ops;
+    if (fread(&magic, sizeof magic, 1, fin) != 1 || magic != TraceMagic)
+    {
+        printf("%s is not a pipeline trace.\n", fileName.c_str());
+        return false;
+    }
+    if (fread(&version, sizeof version, 1, fin) != 1 || version != TraceVersion
+        || fread(&size, sizeof size, 1, fin) != 1 || size != sizeof(TraceRecord)
+        || fread(&ops, sizeof ops, 1, fin) != 1)
+    {
+        printf("unsupported trace version.\n");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < ops; ++i)
+    {
+        string name;
+        int c;
+        while ((c = fgetc(fin)) > 0)
+            name += (char)c;
+        if (c == EOF)
+        {
+            printf("truncated trace header.\n");
+            return false;
+        }
+        opName.push_back(name);
+    }
+    return true;
+}
+
+const char *OpName(int op)
+{
+    return op < (int)opName.size() ? opName[op].c_str() : "?";
+}
+
+// Text: one line per cycle with the inst in every stage, then events
+class TextWriter
+{
+public:
+    TextWriter() : cycle(0), valid(false) {}
+
+    void Add(const TraceRecord &r)
+    {
+        if (valid && r.cycle != cycle)
+            Flush();
+        if (!valid)
+        {
+            cycle = r.cycle;
+            valid = true;
+            for (int i = 0; i < 5; ++i)
+                slot[i] = "-";
+            notes.clear();
+        }
+
+        char buf[128];
+        switch (r.kind)
+        {
+            case TraceRetire:
+                snprintf(buf, sizeof buf, "  retire #%u %s", r.seq, OpName(r.arg));
+                notes += buf;
+            case TraceOccupy:
+                snprintf(buf, sizeof buf, "%08llx#%u", (unsigned long long)r.pc, r.seq);
+                slot[r.stage] = buf;
+                break;
+            case TraceStall:
+            case TraceFlush:
+                snprintf(buf, sizeof buf, "  %s %s #%u (%s)", r.kind == TraceStall ? "stall" : "flush",
+                         stage_str[r.stage], r.seq, r.arg < 4 ? cause_str[r.arg] : "?");
+                notes += buf;
+                break;
+        }
+    }
+
+    void Flush()
+    {
+        if (!valid)
+            return;
+        fprintf(fout, "%10u", cycle);
+        for (int i = 0; i < 5; ++i)
+            fprintf(fout, "  %s %-18s", stage_str[i], slot[i].c_str());
+        fprintf(fout, "%s\n", notes.c_str());
+        valid = false;
+    }
+
+private:
+    uint32_t cycle;
+    bool valid;
+    string slot[5], notes;
+};
+
+// Kanata 0004: insts are created on first sight, move through stages,
+// and retire (R type 0) after writeback or are flushed (R type 1) when
+// squashed or no longer seen in any stage
+class KanataWriter
+{
+public:
+    KanataWriter() : cycle(0), started(false), nextId(0), retireId(0)
+    {
+        fprintf(fout, "Kanata\t0004\n");
+    }
+
+    void Add(const TraceRecord &r)
+    {
+        if (!started)
+        {
+            fprintf(fout, "C=\t%u\n", r.cycle);
+            cycle = r.cycle;
+            started = true;
+        }
+        else if (r.cycle != cycle)
+            Advance(r.cycle);
+
+        unordered_map<uint32_t, Live>::iterator it = live.find(r.seq);
+        if (it == live.end())
+        {
+            if (r.kind == TraceFlush || r.kind == TraceStall)
+                return;
+            Live l;
+            l.id = nextId++;
+            l.stage = -1;
+            fprintf(fout, "I\t%d\t%u\t0\n", l.id, r.seq);
+            fprintf(fout, "L\t%d\t0\t%08llx: %08x\n", l.id, (unsigned long long)r.pc, r.value);
+            it = live.insert(make_pair(r.seq, l)).first;
+        }
+        Live &l = it->second;
+
+        switch (r.kind)
+        {
+            case TraceRetire:
+                fprintf(fout, "L\t%d\t0\t %s\n", l.id, OpName(r.arg));
+                done.push_back(make_pair(l.id, 0));
+            case TraceOccupy:
+                if (l.stage != r.stage)
+                {
+                    fprintf(fout, "S\t%d\t0\t%s\n", l.id, stage_str[r.stage]);
+                    l.stage = r.stage;
+                }
+                l.last = r.cycle;
+                if (r.kind == TraceRetire)
+                    live.erase(it);
+                break;
+            case TraceStall:
+                fprintf(fout, "L\t%d\t1\tstall %s (%s)\n", l.id, stage_str[r.stage],
+                        r.arg < 4 ? cause_str[r.arg] : "?");
+                break;
+            case TraceFlush:
+                fprintf(fout, "L\t%d\t1\tflush %s (%s)\n", l.id, stage_str[r.stage],
+                        r.arg < 4 ? cause_str[r.arg] : "?");
+                done.push_back(make_pair(l.id, 1));
+                live.erase(it);
+                break;
+        }
+    }
+
+    void Finish()
+    {
+        if (started)
+            Advance(cycle + 1);
+    }
+
+private:
+    struct Live
+    {
+        int id, stage;
+        uint32_t last;
+    };
+
+    void Advance(uint32_t to)
+    {
+        // dropped without a flush event, e.g. a fetch cancelled by a stall
+        for (unordered_map<uint32_t, Live>::iterator it = live.begin(); it != live.end(); )
+        {
+            if (it->second.last != cycle)
+            {
+                done.push_back(make_pair(it->second.id, 1));
+                it = live.erase(it);
+            }
+            else
+                ++it;
+        }
+
+        fprintf(fout, "C\t%u\n", to - cycle);
+        cycle = to;
+        for (size_t i = 0; i < done.size(); ++i)
+            fprintf(fout, "R\t%d\t%d\t%d\n", done[i].first,
+                    done[i].second ? 0 : retireId++, done[i].second);
+        done.clear();
+    }
+
+    uint32_t cycle;
+    bool started;
+    int nextId, retireId;
+    unordered_map<uint32_t, Live> live;   // by fetch sequence number
+    vector<pair<int, int> > done;         // id, 0 retire / 1 flush
+};
+
+int main(int argc, char *argv[])
+{
+    ParseArg(argc, argv);
+
+    FILE *fin = fopen(fileName.c_str(), "rb");
+    if (fin == NULL)
+    {
+        printf("can not open file %s.\n", fileName.c_str());
+        return 0;
+    }
+    if (!ReadHeader(fin))
+        return 0;
+
+    fout = stdout;
+    if (!outName.empty() && (fout = fopen(outName.c_str(), "w")) == NULL)
+    {
+        printf("can not write %s.\n", outName.c_str());
+        return 0;
+    }
+
+    TextWriter text;
+    KanataWriter *kw = kanata ? new KanataWriter() : NULL;
+    vector<TraceRecord> buf(ChunkRecords);
+    uint64_t records = 0;
+    size_t n;
+    while ((n = fread(&buf[0], sizeof(TraceRecord), ChunkRecords, fin)) > 0)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            const TraceRecord &r = buf[i];
+            if (r.cycle < startCycle || (numCycles && r.cycle >= startCycle + numCycles))
+                continue;
+            records++;
+            if (kw)
+                kw->Add(r);
+            else
+                text.Add(r);
+        }
+    }
+    if (kw)
+        kw->Finish();
+    else
+        text.Flush();
+
+    fclose(fin);
+    if (fout != stdout)
+    {
+        fclose(fout);
+        printf("decoded %llu records to %s.\n", (unsigned long long)records, outName.c_str());
+    }
+    delete kw;
+
+    return 0;
+}